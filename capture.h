@@ -0,0 +1,184 @@
+/*
+ * capture.h - native capture file format used by pkt_receiver (record) and
+ * pkt_sender (replay).
+ *
+ * File is a struct capture_file_hdr followed by records: struct capture_rec
+ * (receive timestamp plus packet header exactly as it was on the wire, i.e.
+ * in network order) and `size' bytes of payload. Records are not aligned, so
+ * replay can send header and payload right from the mapped file.
+ */
+
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "proto.h"
+
+#define CAPTURE_MAGIC 0x50435046 /* "PCPF" */
+#define CAPTURE_VERSION 2 /* 2: pkt_header got class field */
+#define CAPTURE_WRITE_BUF (1 << 20)
+
+struct capture_file_hdr {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t pkt_header_size;
+} __attribute__((packed));
+
+struct capture_rec {
+        uint64_t ts_ns;         /* CLOCK_MONOTONIC receive time (host order) */
+        struct pkt_header h;    /* network order */
+} __attribute__((packed));
+
+struct capture_writer {
+        FILE *f;
+        char *buf;
+        unsigned long recs;
+};
+
+struct capture_reader {
+        uint8_t *map;
+        size_t len;
+        size_t off;
+};
+
+/* returns 0 on success */
+static inline int
+capture_writer_open(struct capture_writer *w, const char *path)
+{
+        struct capture_file_hdr fh = { CAPTURE_MAGIC, CAPTURE_VERSION,
+                                       sizeof(struct pkt_header) };
+
+        w->recs = 0;
+
+        if ((w->f = fopen(path, "w")) == NULL) {
+                fprintf(stderr, "fopen('%s') failed: %s\n", path, strerror(errno));
+                return -1;
+        }
+
+        if ((w->buf = malloc(CAPTURE_WRITE_BUF)) != NULL)
+                setvbuf(w->f, w->buf, _IOFBF, CAPTURE_WRITE_BUF);
+
+        if (fwrite(&fh, sizeof(fh), 1, w->f) != 1) {
+                fprintf(stderr, "fwrite('%s') failed: %s\n", path, strerror(errno));
+                fclose(w->f);
+                free(w->buf);
+                return -1;
+        }
+
+        return 0;
+}
+
+/* `p' is in host order */
+static inline void
+capture_write(struct capture_writer *w, uint64_t ts_ns, struct pkt_header *p, uint8_t *buf)
+{
+        struct capture_rec rec;
+
+        rec.ts_ns = ts_ns;
+        rec.h = *p;
+        pkt_header_hton(&rec.h);
+
+        if (fwrite(&rec, sizeof(rec), 1, w->f) != 1 ||
+            fwrite(buf, 1, p->size, w->f) != p->size) {
+                fprintf(stderr, "capture write failed: %s\n", strerror(errno));
+                return;
+        }
+
+        w->recs++;
+}
+
+static inline void
+capture_writer_close(struct capture_writer *w)
+{
+        fclose(w->f);
+        free(w->buf);
+}
+
+/* returns 0 on success */
+static inline int
+capture_reader_open(struct capture_reader *r, const char *path)
+{
+        struct capture_file_hdr *fh;
+        struct stat st;
+        int fd;
+
+        if ((fd = open(path, O_RDONLY)) < 0) {
+                fprintf(stderr, "open('%s') failed: %s\n", path, strerror(errno));
+                return -1;
+        }
+
+        if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*fh)) {
+                fprintf(stderr, "'%s' is not a capture file\n", path);
+                close(fd);
+                return -1;
+        }
+
+        r->len = st.st_size;
+        r->map = mmap(NULL, r->len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        close(fd);
+
+        if (r->map == MAP_FAILED) {
+                fprintf(stderr, "mmap('%s') failed: %s\n", path, strerror(errno));
+                return -1;
+        }
+
+        madvise(r->map, r->len, MADV_SEQUENTIAL);
+
+        fh = (struct capture_file_hdr *)r->map;
+
+        if (fh->magic != CAPTURE_MAGIC || fh->version != CAPTURE_VERSION ||
+            fh->pkt_header_size != sizeof(struct pkt_header)) {
+                fprintf(stderr, "'%s' is not a compatible capture file\n", path);
+                munmap(r->map, r->len);
+                return -1;
+        }
+
+        r->off = sizeof(*fh);
+
+        return 0;
+}
+
+/*
+ * returns next record (and its payload in `payload') or NULL at the end of
+ * file; pointers stay valid until capture_reader_close()
+ */
+static inline struct capture_rec *
+capture_read(struct capture_reader *r, uint8_t **payload)
+{
+        struct capture_rec *rec;
+        uint16_t size;
+
+        if (r->len - r->off < sizeof(*rec))
+                return NULL;
+
+        rec = (struct capture_rec *)(r->map + r->off);
+        size = ntohs(rec->h.size);
+
+        if (r->len - r->off - sizeof(*rec) < size) {
+                fprintf(stderr, "capture file is truncated\n");
+                return NULL;
+        }
+
+        *payload = r->map + r->off + sizeof(*rec);
+        r->off += sizeof(*rec) + size;
+
+        return rec;
+}
+
+static inline void
+capture_reader_close(struct capture_reader *r)
+{
+        munmap(r->map, r->len);
+}
+
+#endif
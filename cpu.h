@@ -0,0 +1,135 @@
+/*
+ * cpu.h - thread CPU pinning and NUMA node local memory for busy polling
+ * setups, done with raw sched_setaffinity(2)/mbind(2) syscalls so neither
+ * _GNU_SOURCE nor libnuma is needed.
+ */
+
+#ifndef _CPU_H_
+#define _CPU_H_
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define CPU_MASK_WORDS 16                       /* up to 1024 CPUs/nodes */
+#define CPU_MASK_BITS (CPU_MASK_WORDS * 8 * sizeof(unsigned long))
+#define CPU_HUGE_PAGE_SIZE (2UL << 20)
+
+static inline void
+cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        __asm__ __volatile__("yield" ::: "memory");
+#else
+        __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+static inline void
+cpu_mask_set(unsigned long *mask, unsigned int bit)
+{
+        mask[bit / (8 * sizeof(unsigned long))] |= 1UL << (bit % (8 * sizeof(unsigned long)));
+}
+
+/* pin calling thread to `cpu', returns 0 on success */
+static inline int
+cpu_pin_self(int cpu)
+{
+        unsigned long mask[CPU_MASK_WORDS] = { 0 };
+
+        if (cpu < 0 || (size_t)cpu >= CPU_MASK_BITS) {
+                errno = EINVAL;
+                return -1;
+        }
+
+        cpu_mask_set(mask, cpu);
+
+        return syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) < 0 ? -1 : 0;
+}
+
+/* NUMA node `cpu' belongs to or -1 if unknown (e.g. no NUMA support) */
+static inline int
+cpu_node(int cpu)
+{
+        char path[64];
+        struct dirent *de;
+        DIR *dir;
+        int node = -1;
+
+        if (cpu < 0)
+                return -1;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+
+        if ((dir = opendir(path)) == NULL)
+                return -1;
+
+        while ((de = readdir(dir)) != NULL) {
+                if (strncmp(de->d_name, "node", 4) == 0 &&
+                    de->d_name[4] >= '0' && de->d_name[4] <= '9') {
+                        node = atoi(de->d_name + 4);
+                        break;
+                }
+        }
+
+        closedir(dir);
+
+        return node;
+}
+
+/*
+ * zeroed anonymous memory preferably placed on `node' (-1: no preference),
+ * in huge pages if `huge' (normal pages if none are available). Memory is
+ * prefaulted, so no page faults are taken on fast path. `maplen' is set to
+ * the mapped length (for munmap()). Returns NULL on failure.
+ */
+static inline void *
+cpu_node_alloc(size_t len, int node, int huge, size_t *maplen)
+{
+        unsigned long nodemask[CPU_MASK_WORDS] = { 0 };
+        size_t page = sysconf(_SC_PAGESIZE);
+        void *p = MAP_FAILED;
+
+        if (huge) {
+                *maplen = (len + CPU_HUGE_PAGE_SIZE - 1) & ~(CPU_HUGE_PAGE_SIZE - 1);
+                p = mmap(NULL, *maplen, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+                if (p == MAP_FAILED)
+                        fprintf(stderr, "MAP_HUGETLB failed (%s), using normal pages\n",
+                                strerror(errno));
+        }
+
+        if (p == MAP_FAILED) {
+                *maplen = (len + page - 1) & ~(page - 1);
+                p = mmap(NULL, *maplen, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+                if (p == MAP_FAILED)
+                        return NULL;
+        }
+
+        if (node >= 0 && (size_t)node < CPU_MASK_BITS) {
+                cpu_mask_set(nodemask, node);
+
+                /* policy applies to pages faulted in below */
+                if (syscall(SYS_mbind, p, *maplen, MPOL_PREFERRED, nodemask,
+                            CPU_MASK_BITS, 0) < 0)
+                        fprintf(stderr, "mbind(node %d) failed: %s\n", node, strerror(errno));
+        }
+
+        memset(p, 0, *maplen);
+
+        return p;
+}
+
+#endif
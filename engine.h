@@ -0,0 +1,105 @@
+#ifndef _PKT_ENGINE_H_
+#define _PKT_ENGINE_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/resource.h>
+
+/* I/O engine used for socket transports */
+enum pkt_engine {
+        PKT_ENGINE_CLASSIC = 0,     /* blocking read()/write() via atomicio() */
+        PKT_ENGINE_URING,           /* io_uring */
+        PKT_ENGINE_URING_SQPOLL,    /* io_uring with kernel SQ polling thread */
+};
+
+struct engine_stats {
+        unsigned long pkts;
+        unsigned long bytes;
+        unsigned long syscalls;
+
+        struct timespec first;
+        struct timespec last;
+
+        struct rusage ru_start;     /* see engine_stats_cpu_start() */
+};
+
+static inline int
+engine_parse(const char *spec, enum pkt_engine *e)
+{
+        if (strcmp(spec, "classic") == 0)
+                *e = PKT_ENGINE_CLASSIC;
+        else if (strcmp(spec, "uring") == 0)
+                *e = PKT_ENGINE_URING;
+        else if (strcmp(spec, "uring-sqpoll") == 0)
+                *e = PKT_ENGINE_URING_SQPOLL;
+        else
+                return -1;
+
+        return 0;
+}
+
+static inline const char *
+engine_name(enum pkt_engine e)
+{
+        switch (e) {
+        case PKT_ENGINE_URING:
+                return "uring";
+        case PKT_ENGINE_URING_SQPOLL:
+                return "uring-sqpoll";
+        default:
+                return "classic";
+        }
+}
+
+static inline void
+engine_stats_account(struct engine_stats *st, size_t bytes)
+{
+        clock_gettime(CLOCK_MONOTONIC, &st->last);
+
+        if (st->pkts == 0)
+                st->first = st->last;
+
+        st->pkts++;
+        st->bytes += bytes;
+}
+
+static inline void
+engine_stats_print(FILE *f, enum pkt_engine e, struct engine_stats *st)
+{
+        double elapsed = (st->last.tv_sec - st->first.tv_sec) +
+                (st->last.tv_nsec - st->first.tv_nsec) / 1e9;
+
+        fprintf(f, "ENGINE %s pkts=%lu syscalls=%lu syscalls/pkt=%.3f pps=%.0f MB/s=%.3f\n",
+                engine_name(e), st->pkts, st->syscalls,
+                st->pkts ? (double)st->syscalls / st->pkts : 0.0,
+                elapsed > 0 ? st->pkts / elapsed : 0.0,
+                elapsed > 0 ? st->bytes / elapsed / 1e6 : 0.0);
+}
+
+static inline void
+engine_stats_cpu_start(struct engine_stats *st)
+{
+        getrusage(RUSAGE_SELF, &st->ru_start);
+}
+
+/* process CPU time spent since engine_stats_cpu_start() per packet */
+static inline void
+engine_stats_cpu_print(FILE *f, const char *mode, struct engine_stats *st)
+{
+        struct rusage ru;
+        double user, sys;
+
+        getrusage(RUSAGE_SELF, &ru);
+
+        user = (ru.ru_utime.tv_sec - st->ru_start.ru_utime.tv_sec) +
+                (ru.ru_utime.tv_usec - st->ru_start.ru_utime.tv_usec) / 1e6;
+        sys = (ru.ru_stime.tv_sec - st->ru_start.ru_stime.tv_sec) +
+                (ru.ru_stime.tv_usec - st->ru_start.ru_stime.tv_usec) / 1e6;
+
+        fprintf(f, "CPU %s pkts=%lu user_s=%.3f sys_s=%.3f usec/pkt=%.3f\n",
+                mode, st->pkts, user, sys, st->pkts ? (user + sys) * 1e6 / st->pkts : 0.0);
+}
+
+#endif
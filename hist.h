@@ -0,0 +1,109 @@
+/*
+ * hist.h - log-linear histogram of nanosecond values for percentiles: every
+ * power of 2 range is split into HIST_SUB equal buckets, so a percentile is
+ * off by at most 1/HIST_SUB of its value. Fixed size, no allocation, add is
+ * a couple of instructions.
+ */
+
+#ifndef _HIST_H_
+#define _HIST_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define HIST_SUB_BITS 3
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (64 * HIST_SUB)
+
+struct hist {
+        uint64_t count[HIST_BUCKETS];
+        uint64_t n;
+        uint64_t max;
+};
+
+static inline void
+hist_init(struct hist *h)
+{
+        memset(h, 0, sizeof(*h));
+}
+
+static inline unsigned int
+hist_bucket(uint64_t v)
+{
+        unsigned int msb;
+
+        if (v < HIST_SUB)
+                return v;
+
+        msb = 63 - __builtin_clzll(v);
+
+        return (msb - HIST_SUB_BITS + 1) * HIST_SUB +
+                ((v >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* largest value falling into bucket `b' */
+static inline uint64_t
+hist_bucket_max(unsigned int b)
+{
+        unsigned int msb;
+        uint64_t lo;
+
+        if (b < HIST_SUB)
+                return b;
+
+        msb = b / HIST_SUB + HIST_SUB_BITS - 1;
+        lo = (1ULL << msb) + (uint64_t)(b % HIST_SUB) * (1ULL << (msb - HIST_SUB_BITS));
+
+        return lo + (1ULL << (msb - HIST_SUB_BITS)) - 1;
+}
+
+static inline void
+hist_add(struct hist *h, uint64_t v)
+{
+        h->count[hist_bucket(v)]++;
+        h->n++;
+
+        if (v > h->max)
+                h->max = v;
+}
+
+static inline void
+hist_merge(struct hist *dst, const struct hist *src)
+{
+        unsigned int i;
+
+        for (i = 0; i < HIST_BUCKETS; i++)
+                dst->count[i] += src->count[i];
+
+        dst->n += src->n;
+
+        if (src->max > dst->max)
+                dst->max = src->max;
+}
+
+/* value `q' (0..1) of all values are at or below, 0 if histogram is empty */
+static inline uint64_t
+hist_percentile(const struct hist *h, double q)
+{
+        uint64_t rank, seen = 0;
+        unsigned int i;
+
+        if (h->n == 0)
+                return 0;
+
+        rank = (uint64_t)(q * h->n);
+
+        if (rank >= h->n)
+                rank = h->n - 1;
+
+        for (i = 0; i < HIST_BUCKETS; i++) {
+                seen += h->count[i];
+
+                if (seen > rank)
+                        return hist_bucket_max(i) < h->max ? hist_bucket_max(i) : h->max;
+        }
+
+        return h->max;
+}
+
+#endif
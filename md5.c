@@ -4,6 +4,7 @@
  * License: MIT
  */
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,13 +16,19 @@
 // leftrotate function definition
 #define LEFTROTATE(x, c) (((x) << (c)) | ((x) >> (32 - (c))))
 
-static uint8_t *msg = NULL;
-
-size_t initial_len = -1;
-int new_len = -1;
-
-void
-md5_csum_init (size_t len)
+/*
+ * padded message buffer, one per thread: sized and stamped with bit length
+ * of `msg_len' byte messages, redone when checksum length changes and freed
+ * at thread exit
+ */
+static __thread uint8_t *msg = NULL;
+static __thread size_t msg_len;
+static pthread_key_t msg_key;
+static pthread_once_t msg_key_once = PTHREAD_ONCE_INIT;
+
+/* padded length of `initial_len' byte message, its bit length goes right after */
+static int
+md5_padded_len (size_t initial_len)
 {
         // Pre-processing: adding a single 1 bit
         //append "1" bit to message
@@ -31,21 +38,61 @@ md5_csum_init (size_t len)
         // Pre-processing: padding with zeros
         //append "0" bit until message length in bit ≡ 448 (mod 512)
         //append length mod (2 pow 64) to message
-        initial_len = len;
-        new_len = ((((initial_len + 8) / 64) + 1) * 64) - 8;
+        return ((((initial_len + 8) / 64) + 1) * 64) - 8;
+}
+
+static void
+md5_msg_key_create (void)
+{
+        if (pthread_key_create(&msg_key, free) != 0) {
+                fprintf(stderr, "pthread_key_create()\n");
+                exit(EXIT_FAILURE);
+        }
+}
+
+static void
+md5_msg_alloc (size_t initial_len)
+{
+        int new_len = md5_padded_len(initial_len);
+
+        if (msg != NULL && msg_len == initial_len)
+                return;
+
+        pthread_once(&msg_key_once, md5_msg_key_create);
+        free(msg);
 
         msg = calloc(new_len + 64, 1); // also appends "0" bits
         // (we alloc also 64 extra bytes...)
         //memcpy(msg, initial_msg, initial_len);
         //msg[initial_len] = 128; // write the "1" bit
 
+        if (msg == NULL) {
+                fprintf(stderr, "calloc()\n");
+                exit(EXIT_FAILURE);
+        }
+
         uint32_t bits_len = 8*initial_len; // note, we append the len
         memcpy(msg + new_len, &bits_len, 4);           // in bits at the end of the buffer
+
+        msg_len = initial_len;
+        pthread_setspecific(msg_key, msg);
 }
 
 struct md5_csum
-md5_csum (uint8_t *initial_msg)
+md5_csum (uint8_t *initial_msg, size_t initial_len)
 {
+        return md5_csum_n(initial_msg, initial_len, initial_len);
+}
+
+/*
+ * same as md5_csum(), but only `len' bytes of `initial_msg' are read, the rest
+ * of the message is zero padded (so buffer can be checksummed in place)
+ */
+struct md5_csum
+md5_csum_n (uint8_t *initial_msg, size_t len, size_t initial_len)
+{
+        int new_len = md5_padded_len(initial_len);
+
         // Message (to prepare)
         struct md5_csum csum;
 
@@ -103,7 +150,13 @@ md5_csum (uint8_t *initial_msg)
         uint32_t bits_len = 8*initial_len; // note, we append the len
         memcpy(msg + new_len, &bits_len, 4);           // in bits at the end of the buffer
 #endif
-        memcpy(msg, initial_msg, initial_len);
+        if (len > initial_len)
+                len = initial_len;
+
+        md5_msg_alloc(initial_len);
+
+        memcpy(msg, initial_msg, len);
+        memset(msg + len, 0, initial_len - len);
         msg[initial_len] = 128; // write the "1" bit
 
         // Process the message in successive 512-bit chunks:
@@ -7,6 +7,7 @@
 #ifndef _MY_MD5_H_
 #define _MY_MD5_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 struct md5_csum {
@@ -16,7 +17,8 @@ struct md5_csum {
         uint32_t h3;
 };
 
-void md5_csum_init (size_t initial_len);
-struct md5_csum md5_csum(uint8_t *initial_msg);
+/* checksum of `initial_len' byte message */
+struct md5_csum md5_csum(uint8_t *initial_msg, size_t initial_len);
+struct md5_csum md5_csum_n(uint8_t *initial_msg, size_t len, size_t initial_len);
 
 #endif
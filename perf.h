@@ -0,0 +1,228 @@
+/*
+ * perf.h - hardware counters (cycles, instructions, cache and branch misses)
+ * around code sections, via perf_event_open(2) directly.
+ *
+ * Every thread opens its own counter group (perf_thread_open() must be
+ * called by the thread itself) and reads all counters with one read() at
+ * section start and end, deltas are summed up per section. As that costs two
+ * syscalls, only every `sample'-th execution of a section is measured; per
+ * packet numbers are scaled back by calls/sampled. Events hardware or kernel
+ * doesn't provide (VMs, containers, perf_event_paranoid) are left out, if
+ * none can be opened sections are just counted.
+ */
+
+#ifndef _PERF_H_
+#define _PERF_H_
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+enum perf_ev {
+        PERF_EV_CYCLES = 0,
+        PERF_EV_INSTRUCTIONS,
+        PERF_EV_CACHE_MISSES,
+        PERF_EV_BRANCH_MISSES,
+        PERF_EV_MAX,
+};
+
+struct perf_thread {
+        int fd;                         /* group leader, -1: no counters */
+        int fds[PERF_EV_MAX];
+        int idx[PERF_EV_MAX];           /* position in group read, -1: not counted */
+        unsigned int nr;
+        unsigned int sample;            /* measure every sample-th section call */
+        int user_only;                  /* kernel refused to count kernel mode */
+};
+
+struct perf_section {
+        const char *name;
+        struct perf_thread *t;
+
+        uint64_t calls;
+        uint64_t sampled;
+        uint64_t val[PERF_EV_MAX];
+};
+
+/* counters at section start */
+struct perf_snap {
+        int on;
+        uint64_t v[PERF_EV_MAX];
+};
+
+static inline int
+perf_event_open_one(enum perf_ev e, int group, int user_only)
+{
+        static const uint64_t config[PERF_EV_MAX] = {
+                PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES,
+        };
+        struct perf_event_attr a;
+
+        memset(&a, 0, sizeof(a));
+        a.size = sizeof(a);
+        a.type = PERF_TYPE_HARDWARE;
+        a.config = config[e];
+        a.disabled = (group < 0);
+        a.exclude_kernel = user_only;
+        a.exclude_hv = 1;
+        a.read_format = PERF_FORMAT_GROUP;
+
+        return syscall(SYS_perf_event_open, &a, 0, -1, group, 0);
+}
+
+/* returns 0 if at least one counter is available, -1 (errno set) otherwise */
+static inline int
+perf_thread_open(struct perf_thread *t, unsigned int sample)
+{
+        int e, fd, err = 0;
+
+        t->fd = -1;
+        t->nr = 0;
+        t->sample = sample ? sample : 1;
+        t->user_only = 0;
+
+        for (e = 0; e < PERF_EV_MAX; e++) {
+                t->fds[e] = -1;
+                t->idx[e] = -1;
+        }
+
+        for (e = 0; e < PERF_EV_MAX; e++) {
+                fd = perf_event_open_one(e, t->fd, t->user_only);
+
+                /* paranoid kernels only allow user mode counting */
+                if (fd < 0 && (errno == EACCES || errno == EPERM) && !t->user_only &&
+                    t->fd < 0) {
+                        t->user_only = 1;
+                        fd = perf_event_open_one(e, t->fd, t->user_only);
+                }
+
+                if (fd < 0) {
+                        err = errno;
+                        continue;
+                }
+
+                if (t->fd < 0)
+                        t->fd = fd;
+
+                t->fds[e] = fd;
+                t->idx[e] = t->nr++;
+        }
+
+        if (t->fd < 0) {
+                errno = err;
+                return -1;
+        }
+
+        ioctl(t->fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(t->fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+        return 0;
+}
+
+static inline void
+perf_thread_disable(struct perf_thread *t)
+{
+        t->fd = -1;
+        t->nr = 0;
+        t->sample = 1;
+        memset(t->fds, -1, sizeof(t->fds));
+        memset(t->idx, -1, sizeof(t->idx));
+}
+
+static inline void
+perf_thread_close(struct perf_thread *t)
+{
+        int e;
+
+        for (e = 0; e < PERF_EV_MAX; e++) {
+                if (t->fds[e] >= 0)
+                        close(t->fds[e]);
+        }
+
+        perf_thread_disable(t);
+}
+
+static inline int
+perf_read_counters(struct perf_thread *t, uint64_t *v)
+{
+        uint64_t buf[1 + PERF_EV_MAX];
+        int e;
+
+        if (read(t->fd, buf, sizeof(buf)) < (ssize_t)((1 + t->nr) * sizeof(uint64_t)))
+                return -1;
+
+        for (e = 0; e < PERF_EV_MAX; e++)
+                v[e] = (t->idx[e] >= 0) ? buf[1 + t->idx[e]] : 0;
+
+        return 0;
+}
+
+static inline void
+perf_begin(struct perf_section *s, struct perf_snap *snap)
+{
+        snap->on = 0;
+
+        if (s->calls++ % s->t->sample != 0 || s->t->fd < 0)
+                return;
+
+        snap->on = perf_read_counters(s->t, snap->v) == 0;
+}
+
+static inline void
+perf_end(struct perf_section *s, struct perf_snap *snap)
+{
+        uint64_t v[PERF_EV_MAX];
+        int e;
+
+        if (!snap->on || perf_read_counters(s->t, v) != 0)
+                return;
+
+        for (e = 0; e < PERF_EV_MAX; e++)
+                s->val[e] += v[e] - snap->v[e];
+
+        s->sampled++;
+}
+
+/* per packet averages, section ran for `pkts' packets in all */
+static inline void
+perf_section_print(FILE *f, struct perf_section *s, const char *thread, uint64_t pkts)
+{
+        static const char *names[PERF_EV_MAX] = {
+                "cycles", "instructions", "cache_misses", "branch_misses",
+        };
+        double scale;
+        int e;
+
+        fprintf(f, "PERF %s thread=%s calls=%lu sampled=%lu", s->name, thread,
+                (unsigned long)s->calls, (unsigned long)s->sampled);
+
+        if (s->t->fd < 0) {
+                fprintf(f, " counters=n/a\n");
+                return;
+        }
+
+        /* sampled calls stand for all of them */
+        scale = (s->sampled && pkts) ? (double)s->calls / s->sampled / pkts : 0.0;
+
+        for (e = 0; e < PERF_EV_MAX; e++) {
+                if (s->t->idx[e] < 0)
+                        fprintf(f, " %s/pkt=n/a", names[e]);
+                else
+                        fprintf(f, " %s/pkt=%.1f", names[e], s->val[e] * scale);
+        }
+
+        if (s->t->idx[PERF_EV_CYCLES] >= 0 && s->t->idx[PERF_EV_INSTRUCTIONS] >= 0)
+                fprintf(f, " ipc=%.2f", s->val[PERF_EV_CYCLES] ?
+                        (double)s->val[PERF_EV_INSTRUCTIONS] / s->val[PERF_EV_CYCLES] : 0.0);
+
+        fprintf(f, "%s\n", s->t->user_only ? " user-only" : "");
+}
+
+#endif
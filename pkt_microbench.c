@@ -0,0 +1,581 @@
+/*
+ * pkt_microbench - microbenchmarks of pkt_sender/pkt_receiver building
+ * blocks: md5 checksum, ring buffer (one thread and producer/consumer pair)
+ * and atomicio() over pipes and socketpairs.
+ *
+ * Operations per repetition are calibrated so that one runs for at least
+ * rep-msec, warm-up repetitions are thrown away and median and median
+ * absolute deviation of ns/op over measured ones are reported (one stray
+ * preemption doesn't move either). Every benchmark runs on a fresh thread,
+ * pinned as asked.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "atomic_io.h"
+#include "cpu.h"
+#include "hist.h"
+#include "md5.h"
+#include "pkt_microbench.h"
+#include "pkt_sender.h"
+#include "ring_buffer.h"
+
+struct bench;
+
+/* runs `ops' operations, returns elapsed ns */
+typedef uint64_t (*bench_fn)(struct bench *b, uint64_t ops);
+
+struct bench {
+        const char *name;
+        const char *param;      /* what `arg' is */
+        uint32_t arg;
+        uint32_t bytes;         /* moved per operation */
+        bench_fn fn;
+        int latency;            /* per packet latency goes into bench_lat */
+
+        struct ring_buffer_t ring;
+        int ring_ready;
+
+        /* results */
+        uint64_t ops;           /* per repetition */
+        double ns_op;
+        double mad;
+};
+
+/* producer side of cross-thread benchmarks */
+struct bench_peer {
+        struct bench *b;
+        uint64_t ops;
+        int fd;
+};
+
+static unsigned int reps = PMBENCH_REPS;
+static unsigned int warmup = PMBENCH_WARMUP_REPS;
+static unsigned long rep_msec = PMBENCH_REP_MSEC;
+static int cpu = -1;
+static const char *filter = NULL;
+static const char *csv_path = NULL;
+static const char *tag = "-";
+
+static uint8_t payload[64 * 1024];
+static struct pkt_header hdr;
+
+static struct hist bench_lat;
+static volatile int bench_lat_on = 0;  /* measured repetitions only */
+
+static void
+usage (int ret)
+{
+        fprintf(stderr, "Usage:\n");
+        fprintf(stderr, "\t%s [-h] [-l] [-b NAME] [-r REPS] [-w REPS] [-T MSECS] [-c CPU] [-o FILE] [-t TAG]\n\n",
+                PMBENCH_NAME);
+
+        fprintf(stderr, "\t%-16s %s\n", "-h", "Display usage information and exit");
+        fprintf(stderr, "\t%-16s %s\n", "-l", "List benchmarks and exit");
+        fprintf(stderr, "\t%-16s %s\n", "-b NAME",
+                "Run only benchmarks with NAME in their name (all by default)");
+        fprintf(stderr, "\t%-16s %s (%u by default)\n", "-r REPS",
+                "Measured repetitions", PMBENCH_REPS);
+        fprintf(stderr, "\t%-16s %s (%u by default)\n", "-w REPS",
+                "Warm-up repetitions", PMBENCH_WARMUP_REPS);
+        fprintf(stderr, "\t%-16s %s (%u by default)\n", "-T MSECS",
+                "Minimum duration of repetition", PMBENCH_REP_MSEC);
+        fprintf(stderr, "\t%-16s %s\n", "-c CPU",
+                "Pin benchmark threads to CPU (recommended)");
+        fprintf(stderr, "\t%-16s %s\n", "-o FILE",
+                "Append results to CSV file FILE (header is written to new one)");
+        fprintf(stderr, "\t%-16s %s\n", "-t TAG",
+                "Tag results with TAG (e.g. git revision) to compare builds");
+
+        exit(ret);
+}
+
+static uint64_t
+bench_md5 (struct bench *b, uint64_t ops)
+{
+        volatile uint32_t sink;
+        struct md5_csum cs;
+        uint64_t i, start;
+
+        start = ring_buffer_now_ns();
+
+        for (i = 0; i < ops; i++) {
+                payload[0] = i;
+                cs = md5_csum(payload, b->arg);
+                sink = cs.h0;
+        }
+
+        (void)sink;
+
+        return ring_buffer_now_ns() - start;
+}
+
+static struct ring_buffer_t *
+bench_ring (struct bench *b)
+{
+        if (!b->ring_ready) {
+                ring_buffer_init(&b->ring, b->arg);
+                b->ring_ready = 1;
+        }
+
+        return &b->ring;
+}
+
+/* stages up to a burst of packets, returns how many fit */
+static uint32_t
+bench_ring_fill (struct ring_buffer_t *ring, uint64_t left, uint64_t now)
+{
+        struct ring_element_t *slot;
+        uint32_t n;
+
+        for (n = 0; n < PMBENCH_RING_BURST && n < left; n++) {
+                if ((slot = ring_buffer_burst_slot(ring, n)) == NULL)
+                        break;
+
+                memcpy(&slot->h, &hdr, sizeof(struct pkt_header));
+                memcpy(slot->buf, payload, hdr.size);
+                slot->queued_ns = now;
+        }
+
+        return n;
+}
+
+/* per packet lock round trip (ring_buffer_queue/dequeue) */
+static uint64_t
+bench_ring_queue (struct bench *b, uint64_t ops)
+{
+        struct ring_buffer_t *ring = bench_ring(b);
+        static uint8_t buf[PSENDER_DATA_MAX_SIZE];
+        struct pkt_header h;
+        uint64_t i, start;
+
+        start = ring_buffer_now_ns();
+
+        for (i = 0; i < ops; i++) {
+                ring_buffer_queue(ring, &hdr, payload);
+                ring_buffer_dequeue(ring, &h, buf);
+        }
+
+        return ring_buffer_now_ns() - start;
+}
+
+/* burst interface, producer and consumer on one thread */
+static uint64_t
+bench_ring_burst (struct bench *b, uint64_t ops)
+{
+        static struct ring_element_t elems[PMBENCH_RING_BURST];
+        struct ring_buffer_t *ring = bench_ring(b);
+        uint64_t done, start;
+        uint32_t n;
+
+        start = ring_buffer_now_ns();
+
+        for (done = 0; done < ops; done += n) {
+                n = bench_ring_fill(ring, ops - done, 0);
+                ring_buffer_enqueue_burst(ring, n, 0);
+                ring_buffer_dequeue_burst(ring, elems, n);
+        }
+
+        return ring_buffer_now_ns() - start;
+}
+
+static void *
+bench_ring_producer (void *data)
+{
+        struct bench_peer *peer = data;
+        struct ring_buffer_t *ring = &peer->b->ring;
+        uint64_t left = peer->ops;
+        uint32_t n;
+
+        while (left > 0) {
+                /* ring is full: let consumer catch up */
+                if ((n = bench_ring_fill(ring, left, ring_buffer_now_ns())) == 0) {
+                        sched_yield();
+                        continue;
+                }
+
+                ring_buffer_enqueue_burst(ring, n, 0);
+                left -= n;
+        }
+
+        return NULL;
+}
+
+static void
+bench_peer_start (pthread_t *t, void *(*fn)(void *), struct bench_peer *peer)
+{
+        if (pthread_create(t, NULL, fn, peer) != 0) {
+                fprintf(stderr, "pthread_create()\n");
+                exit(EXIT_FAILURE);
+        }
+}
+
+/* burst interface, producer thread to consumer (blocking dequeue, as processor) */
+static uint64_t
+bench_ring_xthread (struct bench *b, uint64_t ops)
+{
+        static struct ring_element_t elems[PMBENCH_RING_BURST];
+        struct bench_peer peer = { .b = b, .ops = ops, .fd = -1 };
+        uint64_t done, start, now;
+        pthread_t producer;
+        uint32_t i, n;
+
+        bench_ring(b);
+
+        start = ring_buffer_now_ns();
+        bench_peer_start(&producer, bench_ring_producer, &peer);
+
+        for (done = 0; done < ops; done += n) {
+                n = ring_buffer_dequeue_burst(&b->ring, elems, PMBENCH_RING_BURST);
+
+                if (!bench_lat_on)
+                        continue;
+
+                now = ring_buffer_now_ns();
+
+                for (i = 0; i < n; i++)
+                        hist_add(&bench_lat, now - elems[i].queued_ns);
+        }
+
+        now = ring_buffer_now_ns();
+        pthread_join(producer, NULL);
+
+        return now - start;
+}
+
+static void *
+bench_io_writer (void *data)
+{
+        struct bench_peer *peer = data;
+        uint64_t i;
+
+        for (i = 0; i < peer->ops; i++) {
+                if (atomicio(vwrite, peer->fd, payload, peer->b->arg) != (ssize_t)peer->b->arg) {
+                        fprintf(stderr, "write() failed: %s\n", strerror(errno));
+                        exit(EXIT_FAILURE);
+                }
+        }
+
+        return NULL;
+}
+
+/* `arg' bytes written by one thread and read by another, both with atomicio() */
+static uint64_t
+bench_io (struct bench *b, uint64_t ops, int *fds)
+{
+        static uint8_t buf[sizeof(payload)];
+        struct bench_peer peer = { .b = b, .ops = ops, .fd = fds[1] };
+        uint64_t i, start, end;
+        pthread_t writer;
+
+        start = ring_buffer_now_ns();
+        bench_peer_start(&writer, bench_io_writer, &peer);
+
+        for (i = 0; i < ops; i++) {
+                if (atomicio(read, fds[0], buf, b->arg) != (ssize_t)b->arg) {
+                        fprintf(stderr, "read() failed: %s\n", strerror(errno));
+                        exit(EXIT_FAILURE);
+                }
+        }
+
+        end = ring_buffer_now_ns();
+        pthread_join(writer, NULL);
+
+        close(fds[0]);
+        close(fds[1]);
+
+        return end - start;
+}
+
+static uint64_t
+bench_atomicio_pipe (struct bench *b, uint64_t ops)
+{
+        int fds[2];
+
+        if (pipe(fds) != 0) {
+                fprintf(stderr, "pipe() failed: %s\n", strerror(errno));
+                exit(EXIT_FAILURE);
+        }
+
+        return bench_io(b, ops, fds);
+}
+
+static uint64_t
+bench_atomicio_socketpair (struct bench *b, uint64_t ops)
+{
+        int fds[2];
+
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+                fprintf(stderr, "socketpair() failed: %s\n", strerror(errno));
+                exit(EXIT_FAILURE);
+        }
+
+        return bench_io(b, ops, fds);
+}
+
+#define PKT_BYTES (sizeof(struct pkt_header) + PMBENCH_PKT_SIZE)
+
+#define BENCH_MD5(size) \
+        { .name = "md5", .param = "size", .arg = size, .bytes = size, .fn = bench_md5 }
+#define BENCH_RING(n, f, size, lat) \
+        { .name = n, .param = "ring", .arg = size, .bytes = PKT_BYTES, .fn = f, .latency = lat }
+#define BENCH_IO(n, f, size) \
+        { .name = n, .param = "size", .arg = size, .bytes = size, .fn = f }
+
+static struct bench benches[] = {
+        BENCH_MD5(64),
+        BENCH_MD5(256),
+        BENCH_MD5(PSENDER_DATA_MIN_SIZE),
+        BENCH_MD5(PSENDER_DATA_MAX_SIZE),
+        BENCH_MD5(4096),
+        BENCH_RING("ring_queue", bench_ring_queue, 16, 0),
+        BENCH_RING("ring_queue", bench_ring_queue, 256, 0),
+        BENCH_RING("ring_queue", bench_ring_queue, 4096, 0),
+        BENCH_RING("ring_burst", bench_ring_burst, 16, 0),
+        BENCH_RING("ring_burst", bench_ring_burst, 256, 0),
+        BENCH_RING("ring_burst", bench_ring_burst, 4096, 0),
+        BENCH_RING("ring_xthread", bench_ring_xthread, 16, 1),
+        BENCH_RING("ring_xthread", bench_ring_xthread, 256, 1),
+        BENCH_RING("ring_xthread", bench_ring_xthread, 4096, 1),
+        BENCH_IO("atomicio_pipe", bench_atomicio_pipe, 64),
+        BENCH_IO("atomicio_pipe", bench_atomicio_pipe, 1500),
+        BENCH_IO("atomicio_pipe", bench_atomicio_pipe, 65536),
+        BENCH_IO("atomicio_socketpair", bench_atomicio_socketpair, 64),
+        BENCH_IO("atomicio_socketpair", bench_atomicio_socketpair, 1500),
+        BENCH_IO("atomicio_socketpair", bench_atomicio_socketpair, 65536),
+};
+
+#define NBENCHES (sizeof(benches) / sizeof(benches[0]))
+
+static int
+cmp_double (const void *a, const void *b)
+{
+        double x = *(const double *)a, y = *(const double *)b;
+
+        return (x > y) - (x < y);
+}
+
+/* sorts `v' */
+static double
+median (double *v, unsigned int n)
+{
+        qsort(v, n, sizeof(double), cmp_double);
+
+        return (n % 2) ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+static void *
+bench_run (void *data)
+{
+        struct bench *b = data;
+        uint64_t ops = 1, t;
+        double *ns, med;
+        unsigned int i;
+
+        if (cpu >= 0 && cpu_pin_self(cpu) != 0)
+                fprintf(stderr, "Failed to pin %s to CPU %d: %s\n", b->name, cpu,
+                        strerror(errno));
+
+        if ((ns = calloc(reps, sizeof(double))) == NULL) {
+                fprintf(stderr, "calloc()\n");
+                exit(EXIT_FAILURE);
+        }
+
+        /* calibration runs double as warm-up */
+        while ((t = b->fn(b, ops)) < rep_msec * 1000000ULL && ops < (1ULL << 40))
+                ops = (t < rep_msec * 1000000ULL / 8) ? ops * 8 : ops * 2;
+
+        for (i = 0; i < warmup; i++)
+                b->fn(b, ops);
+
+        hist_init(&bench_lat);
+        bench_lat_on = 1;
+
+        for (i = 0; i < reps; i++)
+                ns[i] = (double)b->fn(b, ops) / ops;
+
+        bench_lat_on = 0;
+
+        med = median(ns, reps);
+
+        for (i = 0; i < reps; i++)
+                ns[i] = (ns[i] > med) ? ns[i] - med : med - ns[i];
+
+        b->ops = ops;
+        b->ns_op = med;
+        b->mad = median(ns, reps);
+
+        free(ns);
+
+        return NULL;
+}
+
+static void
+bench_print (FILE *f, struct bench *b)
+{
+        fprintf(f, "BENCH %s %s=%u ops=%lu ns_op=%.2f mad_ns=%.2f mad_pct=%.2f gb_s=%.3f",
+                b->name, b->param, b->arg, (unsigned long)b->ops, b->ns_op, b->mad,
+                b->ns_op > 0 ? 100.0 * b->mad / b->ns_op : 0.0,
+                b->ns_op > 0 ? b->bytes / b->ns_op : 0.0);
+
+        if (b->latency)
+                fprintf(f, " lat_p50_ns=%lu lat_p99_ns=%lu",
+                        (unsigned long)hist_percentile(&bench_lat, 0.5),
+                        (unsigned long)hist_percentile(&bench_lat, 0.99));
+
+        fprintf(f, "\n");
+}
+
+static void
+bench_csv (FILE *f, struct bench *b)
+{
+        fprintf(f, "%s,%s,%s,%u,%u,%u,%lu,%.2f,%.2f,%.3f,", tag, b->name, b->param, b->arg,
+                reps, warmup, (unsigned long)b->ops, b->ns_op, b->mad,
+                b->ns_op > 0 ? b->bytes / b->ns_op : 0.0);
+
+        if (b->latency)
+                fprintf(f, "%lu,%lu\n", (unsigned long)hist_percentile(&bench_lat, 0.5),
+                        (unsigned long)hist_percentile(&bench_lat, 0.99));
+        else
+                fprintf(f, ",\n");
+}
+
+int
+main (int argc, char **argv)
+{
+        struct bench *b;
+        struct stat st;
+        FILE *csv = NULL;
+        unsigned int i;
+        pthread_t t;
+        int opt;
+
+        while ((opt = getopt(argc, argv, "hlb:r:w:T:c:o:t:")) != -1) {
+                switch (opt) {
+                case 'h':
+                        usage(EXIT_SUCCESS);
+                        break;
+                case 'l':
+                        for (i = 0; i < NBENCHES; i++)
+                                fprintf(stdout, "%s %s=%u\n", benches[i].name, benches[i].param,
+                                        benches[i].arg);
+                        exit(EXIT_SUCCESS);
+                case 'b':
+                        filter = optarg;
+                        break;
+                case 'r':
+                case 'w':
+                        {
+                                int tmp = atoi(optarg);
+
+                                if (tmp < (opt == 'r') || tmp > 10000) {
+                                        fprintf(stderr, "Incorrect repetitions: %s\n", optarg);
+                                        exit(EINVAL);
+                                }
+
+                                if (opt == 'r')
+                                        reps = tmp;
+                                else
+                                        warmup = tmp;
+                                break;
+                        }
+                case 'T':
+                        {
+                                int tmp = atoi(optarg);
+
+                                if (tmp < 1) {
+                                        fprintf(stderr, "Incorrect duration: %s\n", optarg);
+                                        exit(EINVAL);
+                                }
+
+                                rep_msec = tmp;
+                                break;
+                        }
+                case 'c':
+                        {
+                                char *end;
+                                long tmp = strtol(optarg, &end, 10);
+
+                                if (*end != '\0' || tmp < 0 || tmp >= (long)CPU_MASK_BITS) {
+                                        fprintf(stderr, "Incorrect CPU: %s\n", optarg);
+                                        exit(EINVAL);
+                                }
+
+                                cpu = tmp;
+                                break;
+                        }
+                case 'o':
+                        csv_path = optarg;
+                        break;
+                case 't':
+                        tag = optarg;
+                        break;
+                default:
+                        usage(EINVAL);
+                }
+        }
+
+        for (i = 0; i < sizeof(payload); i++)
+                payload[i] = rand();
+
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.size = PMBENCH_PKT_SIZE;
+
+        if (csv_path) {
+                if ((csv = fopen(csv_path, "a")) == NULL) {
+                        fprintf(stderr, "fopen('%s') failed: %s\n", csv_path, strerror(errno));
+                        exit(EXIT_FAILURE);
+                }
+
+                if (fstat(fileno(csv), &st) == 0 && st.st_size == 0)
+                        fprintf(csv, "tag,bench,param,value,reps,warmup,ops,ns_op,mad_ns,gb_s,"
+                                "lat_p50_ns,lat_p99_ns\n");
+        }
+
+#ifdef __OPTIMIZE__
+        fprintf(stdout, "MICROBENCH tag=%s optimized=1 compiler=\"%s\" reps=%u warmup=%u "
+                "rep_msec=%lu cpu=%d\n", tag, __VERSION__, reps, warmup, rep_msec, cpu);
+#else
+        fprintf(stdout, "MICROBENCH tag=%s optimized=0 compiler=\"%s\" reps=%u warmup=%u "
+                "rep_msec=%lu cpu=%d\n", tag, __VERSION__, reps, warmup, rep_msec, cpu);
+#endif
+
+        for (i = 0; i < NBENCHES; i++) {
+                b = &benches[i];
+
+                if (filter && strstr(b->name, filter) == NULL)
+                        continue;
+
+                if (pthread_create(&t, NULL, bench_run, b) != 0) {
+                        fprintf(stderr, "pthread_create()\n");
+                        exit(EXIT_FAILURE);
+                }
+
+                pthread_join(t, NULL);
+
+                bench_print(stdout, b);
+                fflush(stdout);
+
+                if (csv)
+                        bench_csv(csv, b);
+        }
+
+        if (csv && fclose(csv) != 0) {
+                fprintf(stderr, "fclose('%s') failed: %s\n", csv_path, strerror(errno));
+                exit(EXIT_FAILURE);
+        }
+
+        return 0;
+}
@@ -0,0 +1,15 @@
+#ifndef _PKT_MICROBENCH_H_
+#define _PKT_MICROBENCH_H_
+
+#define PMBENCH_NAME "pmicrobench"
+
+/* Measurement options */
+#define PMBENCH_REPS 15          /* Measured repetitions of every benchmark */
+#define PMBENCH_WARMUP_REPS 3    /* Repetitions run (and thrown away) before them */
+#define PMBENCH_REP_MSEC 20      /* Minimum duration of one repetition (in milliseconds) */
+
+/* Ring benchmarks */
+#define PMBENCH_RING_BURST 32    /* Packets published/taken per ring lock round trip */
+#define PMBENCH_PKT_SIZE 600     /* Payload size of queued packets */
+
+#endif
@@ -18,34 +18,144 @@
 #include <sys/types.h>
 
 #include "atomic_io.h"
-#include "md5.h"
+#include "capture.h"
+#include "cpu.h"
+#include "engine.h"
 #include "pkt_receiver.h"
 #include "pkt_sender.h"
+#include "perf.h"
+#include "pkt_stream.h"
+#include "pktio.h"
 #include "ring_buffer.h"
+#include "shm_ring.h"
+#include "tpacket.h"
+#include "transport.h"
+#include "uring.h"
 
-static pthread_t listener_t;
-static pthread_t processor_t;
+static pthread_t reporter_t;
 
-static struct ring_buffer_t ring_buf;
-static pthread_mutex_t ring_mtx;
+/*
+ * receive pipeline: parse (listener) -> verify -> process (processor), see
+ * pktio.h. By default verify is fused into listener, split pipeline runs it
+ * on its own thread fed by parse ring, so listener only drains the socket.
+ */
+static struct pktio_rx rx;
 
 static int verbose = 0;
 
 static const char *ipaddr = NULL;
 static uint16_t port = PRCVR_PORT;
-static int is_tcp = PRCVR_USE_TCP;
+static enum pkt_transport transport = PRCVR_USE_TCP ? PKT_TRANSPORT_TCP : PKT_TRANSPORT_UDP;
+static const char *transport_arg = NULL;
+static struct shm_ring_t shm_ring;
+static struct tpacket_ring tp_ring;
+static uint32_t tp_block_size = TPACKET_BLOCK_SIZE;
+static uint32_t tp_block_nr = TPACKET_BLOCK_NR;
+static uint32_t tp_retire_tov = TPACKET_RETIRE_TOV;
 static struct sockaddr_in sa;
 
 static int sockfd = -1;
 
-static uint32_t ring_size = PRCVR_RING_SIZE;
+static enum pkt_engine engine = PKT_ENGINE_CLASSIC;
+static struct engine_stats engine_stats;
+static struct uring uring;
+static struct uring_buf_ring uring_bufs;
+
 static uint16_t delay = PRCVR_DELAY;
 
+/* feedback reports: TCP connection itself or side UDP socket otherwise */
+static uint32_t feedback_interval = 0;
+static const char *feedback_addr = PRCVR_FEEDBACK_ADDR;
+static uint16_t feedback_port = PRCVR_FEEDBACK_PORT;
+static struct sockaddr_in feedback_sa;
+static int feedback_fd = -1;
+static pthread_mutex_t feedback_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/* sampled packet lifecycle trace, see trace.h */
+static const char *trace_path = NULL;
+static unsigned int trace_every_n = PRCVR_TRACE_EVERY;
+
+static const char *record_path = NULL;
+static struct capture_writer recorder;
+
+/* listener thread's own state, passed to it as argument */
+struct pkt_listener {
+        struct pkt_stream stream;
+        uint8_t buf[PRCVR_READ_BUF_SIZE];       /* TCP reads (classic engine) */
+};
+
+/* long only options */
+enum {
+        OPT_TP_BLOCK_SIZE = 256,
+        OPT_TP_BLOCKS,
+        OPT_TP_RETIRE,
+        OPT_FEEDBACK_ADDR,
+        OPT_FEEDBACK_PORT,
+        OPT_BUSY_POLL,
+        OPT_LISTENER_CPU,
+        OPT_PROCESSOR_CPU,
+        OPT_HUGEPAGES,
+        OPT_CLASSES,
+        OPT_STRICT,
+        OPT_CLASS_RING,
+        OPT_CLASS_WEIGHT,
+        OPT_CLASS_OVERFLOW,
+        OPT_MAX_AGE,
+        OPT_CLASS_MAX_AGE,
+        OPT_PIPELINE,
+        OPT_VERIFY_CPU,
+        OPT_PARSE_RING,
+        OPT_PERF,
+        OPT_TRACE,
+        OPT_TRACE_EVERY,
+        OPT_SHUTDOWN,
+        OPT_DRAIN_TIMEOUT,
+};
+
+static const struct option long_options[] = {
+        { "help",      no_argument,       NULL, 'h' },
+        { "verbose",   no_argument,       NULL, 'v' },
+        { "udp",       no_argument,       NULL, 'u' },
+        { "transport", required_argument, NULL, 't' },
+        { "addr",      required_argument, NULL, 's' },
+        { "port",      required_argument, NULL, 'p' },
+        { "ring-size", required_argument, NULL, 'S' },
+        { "delay",     required_argument, NULL, 'd' },
+        { "engine",    required_argument, NULL, 'e' },
+        { "record",    required_argument, NULL, 'r' },
+        { "feedback",  required_argument, NULL, 'F' },
+        { "feedback-addr", required_argument, NULL, OPT_FEEDBACK_ADDR },
+        { "feedback-port", required_argument, NULL, OPT_FEEDBACK_PORT },
+        { "busy-poll",     no_argument,       NULL, OPT_BUSY_POLL },
+        { "listener-cpu",  required_argument, NULL, OPT_LISTENER_CPU },
+        { "processor-cpu", required_argument, NULL, OPT_PROCESSOR_CPU },
+        { "hugepages",     no_argument,       NULL, OPT_HUGEPAGES },
+        { "pipeline",      required_argument, NULL, OPT_PIPELINE },
+        { "verify-cpu",    required_argument, NULL, OPT_VERIFY_CPU },
+        { "parse-ring",    required_argument, NULL, OPT_PARSE_RING },
+        { "perf",          required_argument, NULL, OPT_PERF },
+        { "trace",         required_argument, NULL, OPT_TRACE },
+        { "trace-every",   required_argument, NULL, OPT_TRACE_EVERY },
+        { "shutdown",      required_argument, NULL, OPT_SHUTDOWN },
+        { "drain-timeout", required_argument, NULL, OPT_DRAIN_TIMEOUT },
+        { "classes",        required_argument, NULL, OPT_CLASSES },
+        { "strict",         required_argument, NULL, OPT_STRICT },
+        { "class-ring",     required_argument, NULL, OPT_CLASS_RING },
+        { "class-weight",   required_argument, NULL, OPT_CLASS_WEIGHT },
+        { "class-overflow", required_argument, NULL, OPT_CLASS_OVERFLOW },
+        { "max-age",        required_argument, NULL, OPT_MAX_AGE },
+        { "class-max-age",  required_argument, NULL, OPT_CLASS_MAX_AGE },
+        { "tp-block-size", required_argument, NULL, OPT_TP_BLOCK_SIZE },
+        { "tp-blocks",     required_argument, NULL, OPT_TP_BLOCKS },
+        { "tp-retire",     required_argument, NULL, OPT_TP_RETIRE },
+        { NULL, 0, NULL, 0 }
+};
+
 static void
 usage (int ret)
 {
         fprintf(stderr, "Usage:\n");
-        fprintf(stderr, "\t%s [-v] [-h] [-u] [-s IPADDR] [-p PORTNUM] [-S RINGSIZE] [-d DELAY]\n\n",
+        fprintf(stderr, "\t%s [-v] [-h] [-u] [-t TRANSPORT] [-s IPADDR] [-p PORTNUM] [-S RINGSIZE] [-d DELAY] [-e ENGINE] [-r FILE] [-F MSECS]\n\n",
                 PRCVR_NAME);
 
         fprintf(stderr, "\t%-16s %s\n", "-v", "Verbose mode");
@@ -56,40 +166,195 @@ usage (int ret)
         fprintf(stderr, "\t%-16s %s (%u by default)\n", "-P PORTNUM",
                 "Port number to listen on", PRCVR_PORT);
         fprintf(stderr, "\t%-16s %s\n", "-u", "Use UDP protocl (TCP is used by default)");
+        fprintf(stderr, "\t%-16s %s\n", "-t TRANSPORT",
+                "Transport: tcp, udp, shm:NAME (shared memory segment NAME) or");
+        fprintf(stderr, "\t%-16s %s\n", "",
+                "packet:IFACE (UDP captured from IFACE with AF_PACKET mmap ring)");
 
         fprintf(stderr, "\t%-16s %s (%u by default)\n", "-S RINGSIZE", "Size of ring buffer",
                 PRCVR_RING_SIZE);
         fprintf(stderr, "\t%-16s %s (%u by default)\n", "-d DELAY",
                 "Packet processing delay (in msecs)", PRCVR_DELAY);
+        fprintf(stderr, "\t%-16s %s\n", "-e ENGINE",
+                "Socket I/O engine: classic (default), uring or uring-sqpoll");
+        fprintf(stderr, "\t%-16s %s\n", "-r FILE",
+                "Record received packets into FILE (for pkt_sender -R)");
+        fprintf(stderr, "\t%-16s %s\n", "-F MSECS",
+                "Send ring reports to sender every MSECS (for pkt_sender -A)");
+        fprintf(stderr, "\t%-16s %s (\"%s\" by default)\n", "--feedback-addr IPADDR",
+                "Report destination for non-TCP transports", PRCVR_FEEDBACK_ADDR);
+        fprintf(stderr, "\t%-16s %s (%u by default)\n", "--feedback-port PORTNUM",
+                "Report destination port for non-TCP transports", PRCVR_FEEDBACK_PORT);
+
+        fprintf(stderr, "\t%-16s %s\n", "--busy-poll",
+                "Spin on non-blocking socket (SO_BUSY_POLL) and ring instead of sleeping");
+        fprintf(stderr, "\t%-16s %s\n", "--listener-cpu CPU",
+                "Pin listener thread to CPU");
+        fprintf(stderr, "\t%-16s %s\n", "--processor-cpu CPU",
+                "Pin processor thread to CPU (ring buffer is allocated on its NUMA node)");
+        fprintf(stderr, "\t%-16s %s\n", "--hugepages",
+                "Allocate ring buffer in huge pages (MAP_HUGETLB)");
+
+        fprintf(stderr, "\t%-16s %s\n", "--pipeline MODE",
+                "fused (default): listener parses and verifies checksums, or split: verify");
+        fprintf(stderr, "\t%-16s %s\n", "",
+                "stage runs on its own thread, fed by listener through parse ring");
+        fprintf(stderr, "\t%-16s %s\n", "--verify-cpu CPU",
+                "Pin verify stage thread to CPU (split pipeline)");
+        fprintf(stderr, "\t%-16s %s (%u by default)\n", "--parse-ring SIZE",
+                "Size of ring between parse and verify stages", PRCVR_PARSE_RING_SIZE);
+        fprintf(stderr, "\t%-16s %s\n", "--perf N",
+                "Count cycles, instructions, cache and branch misses per pipeline section");
+        fprintf(stderr, "\t%-16s %s\n", "",
+                "(perf_event_open), measuring every N-th section run");
+        fprintf(stderr, "\t%-16s %s\n", "--trace FILE",
+                "Write lifecycle of sampled packets as Chrome trace JSON (Perfetto)");
+        fprintf(stderr, "\t%-16s %s (%u by default)\n", "--trace-every N",
+                "Trace packets with seqid divisible by N", PRCVR_TRACE_EVERY);
+        fprintf(stderr, "\t%-16s %s\n", "--shutdown MODE",
+                "On SIGINT/SIGTERM: drain (default) processes packets still queued, abandon");
+        fprintf(stderr, "\t%-16s %s\n", "",
+                "throws them away (both are counted in SHUTDOWN line)");
+        fprintf(stderr, "\t%-16s %s\n", "--drain-timeout MSECS",
+                "Abandon packets still queued MSECS after signal (never by default)");
+
+        fprintf(stderr, "\t%-16s %s (1..%u, 1 by default)\n", "--classes NUM",
+                "Number of traffic classes, each with its own ring", PKT_CLASSES_MAX);
+        fprintf(stderr, "\t%-16s %s\n", "--strict NUM",
+                "First NUM classes are served in strict priority order, the rest by");
+        fprintf(stderr, "\t%-16s %s\n", "",
+                "weighted deficit round robin (all classes by default)");
+        fprintf(stderr, "\t%-16s %s\n", "--class-ring CLS:SIZE",
+                "Ring size of class CLS (RINGSIZE by default)");
+        fprintf(stderr, "\t%-16s %s\n", "--class-weight CLS:W",
+                "Round robin weight of class CLS (1 by default)");
+        fprintf(stderr, "\t%-16s %s\n", "--class-overflow CLS:POLICY",
+                "What to drop when ring of class CLS is full: drop-tail (default) or drop-head");
+        fprintf(stderr, "\t%-16s %s\n", "--max-age MSECS",
+                "Expire packets queued for longer than MSECS instead of processing them");
+        fprintf(stderr, "\t%-16s %s\n", "--class-max-age CLS:MSECS",
+                "Max age for class CLS (--max-age by default)");
+
+        fprintf(stderr, "\t%-16s %s (%u by default)\n", "--tp-block-size SIZE",
+                "packet: ring block size", TPACKET_BLOCK_SIZE);
+        fprintf(stderr, "\t%-16s %s (%u by default)\n", "--tp-blocks NUM",
+                "packet: number of ring blocks", TPACKET_BLOCK_NR);
+        fprintf(stderr, "\t%-16s %s (%u by default)\n", "--tp-retire MSECS",
+                "packet: block retire timeout", TPACKET_RETIRE_TOV);
 
         exit(ret);
 }
 
+/* verify stage hook: packet is reported (and recorded) as soon as it's verified */
+static void pkt_verified (__attribute__((unused)) void *arg, struct pkt_header *p, uint8_t *buf,
+                          uint64_t now, int ok)
+{
+        fprintf(stdout, "Received: %u %lu.%lu %s\n", p->seqid,
+                (unsigned long)(now / 1000000000ULL), (unsigned long)(now % 1000000000ULL),
+                ok ? "PASS" : "FAIL");
+
+        if (record_path)
+                capture_write(&recorder, now, p, buf);
+}
+
+/* parse stage output, `buf' may point to shared memory */
+static void pkt_deliver (struct pkt_header *p, uint8_t *buf)
+{
+        engine_stats_account(&engine_stats, PKT_HDR_SIZE + p->size);
+        pktio_rx_deliver(&rx, p, buf);
+}
+
+static void nonblock_setup (int fd)
+{
+        if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0)
+                fprintf(stderr, "fcntl(O_NONBLOCK) failed: %s\n", strerror(errno));
+}
+
+/* non-blocking socket, so atomicio() spins on EAGAIN */
+static void busy_poll_setup (int fd)
+{
+        int usec = PRCVR_BUSY_POLL_USEC;
+
+        if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) < 0)
+                fprintf(stderr, "SO_BUSY_POLL failed: %s\n", strerror(errno));
+}
+
+/*
+ * sockets are non-blocking: once drained, listener sleeps in poll() on
+ * socket and stop eventfd (unless busy polling), EOF is returned once stopping
+ */
+static ssize_t counted_read (int fd, void *buf, size_t count)
+{
+        struct perf_snap snap;
+        ssize_t ret;
+
+        engine_stats.syscalls++;
+
+        perf_begin(&rx.perf_read, &snap);
+        ret = read(fd, buf, count);
+        perf_end(&rx.perf_read, &snap);
+
+        if (ret < 0 && errno == EAGAIN) {
+                if (pktio_rx_stopping(&rx))
+                        return 0;
+
+                if (!rx.busy_poll) {
+                        engine_stats.syscalls++;
+
+                        if (pktio_rx_wait(&rx, fd, POLLIN) <= 0)
+                                return 0;
+
+                        errno = EAGAIN;
+                }
+        }
+
+        return ret;
+}
+
+/*
+ * listening socket is non-blocking as well (accepted one is only if
+ * `nonblock'), returns -1 once stopping
+ */
+static int pkt_accept (int nonblock)
+{
+        int fd;
+
+        for (;;) {
+                if ((fd = accept(sockfd, NULL, NULL)) >= 0) {
+                        if (nonblock)
+                                nonblock_setup(fd);
+
+                        return fd;
+                }
+
+                if (errno != EAGAIN && errno != EINTR) {
+                        fprintf(stderr, "accept(): %s\n", strerror(errno));
+                        exit(EXIT_FAILURE);
+                }
+
+                if (pktio_rx_wait(&rx, sockfd, POLLIN) <= 0)
+                        return -1;
+        }
+}
+
 /* break connection on non-nil */
 static int pkt_handle (int fd)
 {
         uint8_t buf[PSENDER_DATA_MAX_SIZE] = {0};
         struct pkt_header p;
-        struct md5_csum cs;
-        struct timespec ts;
         int ret;
 
-        if ((ret  = atomicio(read, fd, &p, sizeof(p))) != sizeof(p)) {
+        /* v1 header, class 0 */
+        p.cls = 0;
+
+        if ((ret  = atomicio(counted_read, fd, &p, PKT_HDR_SIZE)) != PKT_HDR_SIZE) {
                 if (ret != 0)
                         fprintf(stderr, "%s: atomicio(read) returned %d (errno: %s)\n",
                                 __func__, ret, strerror(errno));
                 return 1;
         }
 
-        p.seqid = ntohl(p.seqid);
-        p.sec = ntohl(p.sec);
-        p.msec = ntohs(p.msec);
-        p.size = ntohs(p.size);
-
-        p.h0 = ntohl(p.h0);
-        p.h1 = ntohl(p.h1);
-        p.h2 = ntohl(p.h2);
-        p.h3 = ntohl(p.h3);
+        pkt_header_ntoh(&p);
 
         if (p.size > PSENDER_DATA_MAX_SIZE - 1) {
                 fprintf(stderr, "Protocol mismatch? Got size=%u, dropping..\n",
@@ -97,29 +362,58 @@ static int pkt_handle (int fd)
                 return 1;
         }
 
-        if ((ret = atomicio(read, fd, buf, p.size)) != p.size) {
+        if ((ret = atomicio(counted_read, fd, buf, p.size)) != p.size) {
+                if (pktio_rx_stopping(&rx))
+                        return 1;
+
                 fprintf(stderr, "%s: atomicio(read) returned %d (errno: %s)\n",
                         __func__, ret, strerror(errno));
                 return 1;
         }
 
-        cs = md5_csum(buf);
+        pkt_deliver(&p, buf);
+        pktio_rx_flush(&rx);
+
+        return 0;
+}
+
+/* packets are verified in place, the only copy made is into class ring */
+static void *pkt_listener_shm (__attribute__((unused)) void *data)
+{
+        struct shm_slot *slot;
+        struct pkt_header p;
+
+        while (!pktio_rx_stopping(&rx)) {
+                if (shm_ring_is_empty(&shm_ring)) {
+                        pktio_rx_flush(&rx);
 
-        ret = (cs.h0 == p.h0 && cs.h1 == p.h1 && cs.h2 == p.h2 && cs.h3 == p.h3) ? 0 : 1;
+                        if (rx.busy_poll) {
+                                cpu_relax();
+                                continue;
+                        }
+                }
 
-        clock_gettime(CLOCK_MONOTONIC, &ts); /* XXX: CLOCK_REALTIME? (as pkt_sender) */
+                if ((slot = shm_ring_peek(&shm_ring)) == NULL)
+                        continue;
 
-        fprintf(stdout, "Received: %u %lu.%lu %s\n", p.seqid, ts.tv_sec, ts.tv_nsec,
-                (ret == 0) ? "PASS" : "FAIL");
+                memcpy(&p, &slot->h, sizeof(p));
+                pkt_header_ntoh(&p);
 
-        ring_buffer_queue(&ring_buf, &p, buf);
+                if (p.size > PSENDER_DATA_MAX_SIZE - 1)
+                        fprintf(stderr, "Protocol mismatch? Got size=%u, dropping..\n",
+                                p.size);
+                else
+                        pkt_deliver(&p, slot->buf);
 
-        return 0;
+                shm_ring_release(&shm_ring);
+        }
+
+        return NULL;
 }
 
 static void *pkt_listener_udp (__attribute__((unused)) void *data)
 {
-        while (!is_terminating) {
+        while (!pktio_rx_stopping(&rx)) {
                 if (pkt_handle(sockfd))
                         break;
         }
@@ -127,27 +421,201 @@ static void *pkt_listener_udp (__attribute__((unused)) void *data)
         return NULL;
 }
 
-static void *pkt_listener_tcp (__attribute__((unused)) void *data)
+/* TCP connection is used for reports (reverse direction) */
+static void feedback_set_fd (int fd)
 {
+        pthread_mutex_lock(&feedback_mtx);
+        feedback_fd = fd;
+        pthread_mutex_unlock(&feedback_mtx);
+}
+
+/*
+ * records are parsed right from large read buffer (either protocol version),
+ * so a v2 sender gets many packets per read()
+ */
+static void *pkt_listener_tcp (void *data)
+{
+        struct pkt_listener *l = data;
         int cfd;
-        struct sockaddr_in sa;
-        socklen_t len = sizeof(struct sockaddr_in);
+        ssize_t ret;
 
         do {
-                cfd = accept(sockfd, (struct sockaddr *)&sa, &len);
+                if ((cfd = pkt_accept(1)) < 0)
+                        break;
 
-                if (cfd < 0) {
-                        fprintf(stderr, "accept(): %s\n", strerror(errno));
-                        exit(EXIT_FAILURE);
-                }
+                feedback_set_fd(cfd);
 
-                while (!is_terminating) {
-                        if (pkt_handle(cfd))
+                if (rx.busy_poll)
+                        busy_poll_setup(cfd);
+
+                pkt_stream_reset(&l->stream);
+
+                while (!pktio_rx_stopping(&rx)) {
+                        if ((ret = counted_read(cfd, l->buf, sizeof(l->buf))) < 0) {
+                                if (errno == EINTR || errno == EAGAIN)
+                                        continue;
+
+                                fprintf(stderr, "%s: read() failed: %s\n", __func__,
+                                        strerror(errno));
                                 break;
+                        }
+
+                        if (ret == 0)
+                                break;
+
+                        if (pkt_stream_feed_any(&l->stream, l->buf, ret, pkt_deliver) != 0) {
+                                fprintf(stderr, "Protocol mismatch, dropping..\n");
+                                break;
+                        }
+
+                        pktio_rx_flush(&rx);
                 }
 
+                pktio_rx_flush(&rx);
+
+                feedback_set_fd(-1);
                 close(cfd);
-        } while (!is_terminating);
+        } while (!pktio_rx_stopping(&rx));
+
+        return NULL;
+}
+
+/*
+ * handle UDP datagram, header comes as a datagram on its own so stream is
+ * resynced on it (lost datagram costs one packet only)
+ */
+static void pkt_datagram (void *arg, uint8_t *data, size_t len)
+{
+        struct pkt_listener *l = arg;
+
+        if (len == PKT_HDR_SIZE)
+                pkt_stream_reset(&l->stream);
+
+        if (pkt_stream_feed(&l->stream, data, len, pkt_deliver) != 0) {
+                fprintf(stderr, "Protocol mismatch, dropping..\n");
+                pkt_stream_reset(&l->stream);
+        }
+}
+
+static void *pkt_listener_packet (void *data)
+{
+        while (!pktio_rx_stopping(&rx)) {
+                tpacket_ring_poll(&tp_ring, rx.busy_poll ? 0 : -1, pkt_datagram, data);
+                pktio_rx_flush(&rx);
+        }
+
+        return NULL;
+}
+
+static void pkt_uring_recv (int fd)
+{
+        struct io_uring_sqe *sqe;
+
+        while ((sqe = uring_get_sqe(&uring)) == NULL)
+                uring_submit_and_wait(&uring, 0);
+
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = fd;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = uring_bufs.bgid;
+}
+
+/* stop eventfd poll completes with this user_data (recv ones carry 0) */
+static void pkt_uring_poll_stop (void)
+{
+        struct io_uring_sqe *sqe;
+
+        while ((sqe = uring_get_sqe(&uring)) == NULL)
+                uring_submit_and_wait(&uring, 0);
+
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = rx.stop_fd;
+        sqe->poll32_events = POLLIN;
+        sqe->user_data = 1;
+}
+
+/*
+ * multishot recv into provided buffer ring, packets are parsed right from the
+ * buffers kernel filled in (one copy into class ring as for shm transport)
+ */
+static void *pkt_listener_uring (void *data)
+{
+        struct pkt_listener *l = data;
+        struct io_uring_cqe *cqe;
+        int fd = (transport == PKT_TRANSPORT_TCP) ? -1 : sockfd;
+        int arm = (fd >= 0), broken = 0;
+        uint16_t bid;
+
+        pkt_uring_poll_stop();
+
+        while (!pktio_rx_stopping(&rx)) {
+                pktio_rx_flush(&rx);
+
+                if (fd < 0) {
+                        fd = pkt_accept(0);
+                        engine_stats.syscalls++;
+
+                        if (fd < 0)
+                                break;
+
+                        pkt_stream_reset(&l->stream);
+                        feedback_set_fd(fd);
+                        arm = 1;
+                        broken = 0;
+                }
+
+                if (arm) {
+                        pkt_uring_recv(fd);
+                        arm = 0;
+                }
+
+                for (cqe = uring_wait_cqe_timeout(&uring, RING_BUFFER_COND_TIMEOUT * 1000);
+                     cqe != NULL; cqe = uring_peek_cqe(&uring)) {
+                        int res = cqe->res;
+                        unsigned flags = cqe->flags;
+                        uint64_t stop = cqe->user_data;
+
+                        uring_cqe_seen(&uring);
+
+                        if (stop)
+                                continue;
+
+                        if (!(flags & IORING_CQE_F_MORE))
+                                arm = 1;
+
+                        if (flags & IORING_CQE_F_BUFFER) {
+                                bid = flags >> IORING_CQE_BUFFER_SHIFT;
+
+                                if (transport == PKT_TRANSPORT_UDP) {
+                                        pkt_datagram(l, uring_buf_ring_buf(&uring_bufs, bid), res);
+                                } else if (res > 0 && !broken &&
+                                           pkt_stream_feed_any(&l->stream,
+                                                               uring_buf_ring_buf(&uring_bufs, bid),
+                                                               res, pkt_deliver) != 0) {
+                                        fprintf(stderr, "Protocol mismatch, dropping..\n");
+
+                                        /* recv completes with EOF then */
+                                        shutdown(fd, SHUT_RDWR);
+                                        broken = 1;
+                                }
+
+                                uring_buf_ring_add(&uring_bufs, bid);
+                        }
+
+                        if (res < 0 && res != -ENOBUFS)
+                                fprintf(stderr, "recv(): %s\n", strerror(-res));
+
+                        if (transport == PKT_TRANSPORT_TCP &&
+                            (res == 0 || (res < 0 && res != -ENOBUFS))) {
+                                feedback_set_fd(-1);
+                                close(fd);
+                                fd = -1;
+                                arm = 0;
+                                break;
+                        }
+                }
+        }
 
         return NULL;
 }
@@ -165,43 +633,106 @@ static void msleep(uint16_t msec)
         } while (res && errno == EINTR);
 }
 
-void *pkt_processor (__attribute__((unused)) void *data)
+/* periodic ring report for sender's rate controller */
+static void *pkt_reporter (__attribute__((unused)) void *data)
 {
-        struct pkt_header p;
-        struct timespec ts;
-        struct md5_csum cs;
-        int ret;
+        struct pkt_report r;
+        struct timespec prev, now;
+        uint32_t received, dropped, expired, processed, occupancy, size;
+        uint32_t seq = 0, prev_processed = 0;
+        double dt;
 
-        uint8_t buf[PSENDER_DATA_MAX_SIZE];
+        clock_gettime(CLOCK_MONOTONIC, &prev);
 
-        while (ring_buffer_dequeue(&ring_buf, &p, buf) == 0) {
-                msleep(delay);
+        /* returns at once on shutdown, so it's joined before pipeline goes away */
+        while (pktio_rx_sleep(&rx, feedback_interval)) {
+                pktio_rx_counters(&rx, &received, &dropped, &expired, &processed, &occupancy,
+                                  &size);
 
-                cs = md5_csum(buf);
+                r.received = received;
+                r.dropped = dropped + expired; /* both mean sender is too fast */
+                r.processed = processed;
+                r.occupancy = occupancy;
+                r.ring_size = size;
 
-                ret = (cs.h0 == p.h0 && cs.h1 == p.h1 && cs.h2 == p.h2 && cs.h3 == p.h3) ? 0 : 1;
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                dt = (now.tv_sec - prev.tv_sec) + (now.tv_nsec - prev.tv_nsec) / 1e9;
 
-                clock_gettime(CLOCK_MONOTONIC, &ts);
+                r.magic = PKT_REPORT_MAGIC;
+                r.seq = ++seq;
+                r.rate = dt > 0 ? (r.processed - prev_processed) / dt : 0;
 
-                fprintf(stdout, "Processed: %u %lu.%lu %s\n", p.seqid, ts.tv_sec, ts.tv_nsec,
-                        (ret == 0) ? "PASS" : "FAIL");
+                prev = now;
+                prev_processed = r.processed;
 
-                ring_buf.processed++;
-        }
+                if (verbose)
+                        fprintf(stderr, "Report: %u received %u dropped %u processed %u "
+                                "occupancy %u rate %u\n", r.seq, r.received, r.dropped,
+                                r.processed, r.occupancy, r.rate);
 
-        pthread_mutex_unlock(&ring_buf.mtx);
+                pkt_report_swap(&r);
+
+                if (transport == PKT_TRANSPORT_TCP) {
+                        pthread_mutex_lock(&feedback_mtx);
+
+                        /* never block on sender which doesn't read reports */
+                        if (feedback_fd >= 0)
+                                send(feedback_fd, &r, sizeof(r), MSG_DONTWAIT | MSG_NOSIGNAL);
+
+                        pthread_mutex_unlock(&feedback_mtx);
+                } else {
+                        sendto(feedback_fd, &r, sizeof(r), MSG_DONTWAIT,
+                               (struct sockaddr *)&feedback_sa, sizeof(feedback_sa));
+                }
+        }
 
         return NULL;
 }
 
+/* processor hook: packet that didn't expire is "processed" */
+static void pkt_process (__attribute__((unused)) void *arg, struct pkt_header *p,
+                         __attribute__((unused)) uint8_t *buf, int csum_ok)
+{
+        struct timespec ts;
+
+        if (delay)
+                msleep(delay);
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        /* checksum was verified once, by verify stage */
+        fprintf(stdout, "Processed: %u %lu.%lu %s\n", p->seqid, ts.tv_sec, ts.tv_nsec,
+                csum_ok ? "PASS" : "FAIL");
+}
+
+/* "CLS:VALUE" option argument, `val' is set to VALUE */
+static unsigned int parse_class_arg (const char *arg, const char **val)
+{
+        char *end;
+        long cls = strtol(arg, &end, 10);
+
+        if (end == arg || *end != ':' || cls < 0 || cls >= PKT_CLASSES_MAX) {
+                fprintf(stderr, "Incorrect class: %s\n", arg);
+                exit(EINVAL);
+        }
+
+        *val = end + 1;
+
+        return (unsigned int)cls;
+}
 
 int
 main (int argc, char **argv)
 {
-        int opt;
+        int opt, strict_set = 0;
         sigset_t signals;
+        struct pkt_listener *listener;
+
+        pktio_rx_defaults(&rx);
+        rx.verified = pkt_verified;
+        rx.process = pkt_process;
 
-        while ((opt = getopt(argc, argv, "hvus:S:p:d:")) != -1) {
+        while ((opt = getopt_long(argc, argv, "hvut:s:S:p:d:e:r:F:", long_options, NULL)) != -1) {
                 switch (opt) {
                 case 'v':
                         verbose = 1;
@@ -210,11 +741,240 @@ main (int argc, char **argv)
                         usage(EXIT_SUCCESS);
                         break;
                 case 'u':
-                        is_tcp = 0;
+                        transport = PKT_TRANSPORT_UDP;
+                        break;
+                case 't':
+                        if (transport_parse(optarg, &transport, &transport_arg) != 0) {
+                                fprintf(stderr, "Incorrect transport: %s\n", optarg);
+                                exit(EINVAL);
+                        }
                         break;
                 case 's':
                         ipaddr = optarg;
                         break;
+                case OPT_BUSY_POLL:
+                        rx.busy_poll = 1;
+                        break;
+                case OPT_HUGEPAGES:
+                        rx.hugepages = 1;
+                        break;
+                case OPT_PIPELINE:
+                        if (strcmp(optarg, "fused") == 0) {
+                                rx.pipeline_split = 0;
+                        } else if (strcmp(optarg, "split") == 0) {
+                                rx.pipeline_split = 1;
+                        } else {
+                                fprintf(stderr, "Incorrect pipeline: %s\n", optarg);
+                                exit(EINVAL);
+                        }
+                        break;
+                case OPT_PERF:
+                        {
+                                int tmp = atoi(optarg);
+
+                                if (tmp < 1) {
+                                        fprintf(stderr, "Incorrect sampling: %s\n", optarg);
+                                        exit(EINVAL);
+                                }
+
+                                rx.perf_sample = tmp;
+                                break;
+                        }
+                case OPT_TRACE:
+                        trace_path = optarg;
+                        break;
+                case OPT_TRACE_EVERY:
+                        {
+                                int tmp = atoi(optarg);
+
+                                if (tmp < 1) {
+                                        fprintf(stderr, "Incorrect trace sampling: %s\n", optarg);
+                                        exit(EINVAL);
+                                }
+
+                                trace_every_n = tmp;
+                                break;
+                        }
+                case OPT_SHUTDOWN:
+                        if (strcmp(optarg, "drain") == 0) {
+                                rx.abandon = 0;
+                        } else if (strcmp(optarg, "abandon") == 0) {
+                                rx.abandon = 1;
+                        } else {
+                                fprintf(stderr, "Incorrect shutdown mode: %s\n", optarg);
+                                exit(EINVAL);
+                        }
+                        break;
+                case OPT_DRAIN_TIMEOUT:
+                        {
+                                int tmp = atoi(optarg);
+
+                                if (tmp < 1) {
+                                        fprintf(stderr, "Incorrect drain timeout: %s\n", optarg);
+                                        exit(EINVAL);
+                                }
+
+                                rx.drain_msec = tmp;
+                                break;
+                        }
+                case OPT_PARSE_RING:
+                        {
+                                int tmp = atoi(optarg);
+
+                                if (tmp < 2) {
+                                        fprintf(stderr, "Incorrect ring buffer size: %s\n", optarg);
+                                        exit(EINVAL);
+                                }
+
+                                rx.parse_ring_size = tmp;
+                                break;
+                        }
+                case OPT_LISTENER_CPU:
+                case OPT_PROCESSOR_CPU:
+                case OPT_VERIFY_CPU:
+                        {
+                                char *end;
+                                long tmp = strtol(optarg, &end, 10);
+
+                                if (*end != '\0' || tmp < 0 || tmp >= (long)CPU_MASK_BITS) {
+                                        fprintf(stderr, "Incorrect CPU: %s\n", optarg);
+                                        exit(EINVAL);
+                                }
+
+                                if (opt == OPT_LISTENER_CPU)
+                                        rx.listener.cpu = tmp;
+                                else if (opt == OPT_VERIFY_CPU)
+                                        rx.verifier.cpu = tmp;
+                                else
+                                        rx.processor.cpu = tmp;
+                                break;
+                        }
+                case OPT_TP_BLOCK_SIZE:
+                case OPT_TP_BLOCKS:
+                case OPT_TP_RETIRE:
+                        {
+                                int tmp = -1;
+                                tmp = atoi(optarg);
+
+                                if (tmp < 1 || (opt == OPT_TP_BLOCK_SIZE &&
+                                                (tmp % getpagesize() != 0 ||
+                                                 tmp % TPACKET_FRAME_SIZE != 0))) {
+                                        fprintf(stderr, "Incorrect value: %s\n", optarg);
+                                        exit(EINVAL);
+                                }
+
+                                if (opt == OPT_TP_BLOCK_SIZE)
+                                        tp_block_size = tmp;
+                                else if (opt == OPT_TP_BLOCKS)
+                                        tp_block_nr = tmp;
+                                else
+                                        tp_retire_tov = tmp;
+                                break;
+                        }
+                case OPT_CLASSES:
+                case OPT_STRICT:
+                        {
+                                int tmp = atoi(optarg);
+
+                                if (tmp < (opt == OPT_CLASSES) || tmp > PKT_CLASSES_MAX) {
+                                        fprintf(stderr, "Incorrect number of classes: %s\n", optarg);
+                                        exit(EINVAL);
+                                }
+
+                                if (opt == OPT_CLASSES) {
+                                        rx.sched.nclasses = tmp;
+                                } else {
+                                        rx.sched.nstrict = tmp;
+                                        strict_set = 1;
+                                }
+                                break;
+                        }
+                case OPT_CLASS_RING:
+                case OPT_CLASS_WEIGHT:
+                        {
+                                const char *val;
+                                unsigned int c = parse_class_arg(optarg, &val);
+                                int tmp = atoi(val);
+
+                                if (tmp < 1) {
+                                        fprintf(stderr, "Incorrect value: %s\n", optarg);
+                                        exit(EINVAL);
+                                }
+
+                                if (opt == OPT_CLASS_RING)
+                                        rx.sched.cls[c].ring_size = tmp;
+                                else
+                                        rx.sched.cls[c].weight = tmp;
+                                break;
+                        }
+                case OPT_CLASS_OVERFLOW:
+                        {
+                                const char *val;
+                                unsigned int c = parse_class_arg(optarg, &val);
+
+                                if (sched_parse_overflow(val, &rx.sched.cls[c].overflow) != 0) {
+                                        fprintf(stderr, "Incorrect overflow policy: %s\n", optarg);
+                                        exit(EINVAL);
+                                }
+                                break;
+                        }
+                case OPT_MAX_AGE:
+                case OPT_CLASS_MAX_AGE:
+                        {
+                                const char *val = optarg;
+                                unsigned int c = 0;
+                                int tmp;
+
+                                if (opt == OPT_CLASS_MAX_AGE)
+                                        c = parse_class_arg(optarg, &val);
+
+                                if ((tmp = atoi(val)) < 1) {
+                                        fprintf(stderr, "Incorrect max age: %s\n", optarg);
+                                        exit(EINVAL);
+                                }
+
+                                if (opt == OPT_MAX_AGE)
+                                        rx.sched.max_age_ns = tmp * 1000000ULL;
+                                else
+                                        rx.sched.cls[c].max_age_ns = tmp * 1000000ULL;
+                                break;
+                        }
+                case 'r':
+                        record_path = optarg;
+                        break;
+                case 'F':
+                        {
+                                int tmp = -1;
+                                tmp = atoi(optarg);
+                                if (tmp < 1 || tmp > 65535) {
+                                        fprintf(stderr, "Incorrect report interval: %s\n", optarg);
+                                        exit(EINVAL);
+                                }
+
+                                feedback_interval = tmp;
+                                break;
+                        }
+                case OPT_FEEDBACK_ADDR:
+                        feedback_addr = optarg;
+                        break;
+                case OPT_FEEDBACK_PORT:
+                        {
+                                int tmp = -1;
+                                tmp = atoi(optarg);
+                                if (tmp < 1 || tmp > 65535) {
+                                        fprintf(stderr, "Incorrect port number: %s\n", optarg);
+                                        exit(EINVAL);
+                                }
+
+                                feedback_port = (uint16_t) tmp;
+                                break;
+                        }
+                case 'e':
+                        if (engine_parse(optarg, &engine) != 0) {
+                                fprintf(stderr, "Incorrect engine: %s\n", optarg);
+                                exit(EINVAL);
+                        }
+                        break;
                 case 'p':
                         {
                                 int tmp = -1;
@@ -236,14 +996,14 @@ main (int argc, char **argv)
                                         exit(EINVAL);
                                 }
 
-                                ring_size = (uint32_t) tmp;
+                                rx.ring_size = (uint32_t) tmp;
                                 break;
                         }
-                case 'l':
+                case 'd':
                         {
                                 int tmp = -1;
                                 tmp = atoi(optarg);
-                                if (tmp < 1 || tmp > 65535) {
+                                if (tmp < 0 || tmp > 65535) {
                                         fprintf(stderr, "Incorrect delay: %s\n", optarg);
                                         exit(EINVAL);
                                 }
@@ -258,12 +1018,24 @@ main (int argc, char **argv)
                 }
         }
 
-        md5_csum_init(PSENDER_DATA_MAX_SIZE);
-        ring_buffer_init(&ring_buf, ring_size);
+        /* all classes are strict priority unless --strict says otherwise */
+        if (!strict_set)
+                rx.sched.nstrict = rx.sched.nclasses;
+
+        if (trace_path)
+                rx.trace_every = trace_every_n;
+
+        if (pktio_rx_init(&rx) != 0)
+                exit(EXIT_FAILURE);
 
-        if (pthread_mutex_init(&ring_mtx, NULL) != 0) {
-                fprintf(stderr, "pthread_mutex_lock() failed: %s\n", strerror(errno));
+        if (record_path && capture_writer_open(&recorder, record_path) != 0)
                 exit(EXIT_FAILURE);
+
+        if (transport == PKT_TRANSPORT_SHM) {
+                if (shm_ring_create(&shm_ring, transport_arg, SHM_RING_SLOTS) != 0)
+                        exit(EXIT_FAILURE);
+
+                goto start;
         }
 
         bzero(&sa, sizeof(sa));
@@ -277,7 +1049,7 @@ main (int argc, char **argv)
                 exit(EINVAL);
         }
 
-        sockfd = socket(AF_INET, is_tcp ? SOCK_STREAM : SOCK_DGRAM, 0);
+        sockfd = socket(AF_INET, transport == PKT_TRANSPORT_TCP ? SOCK_STREAM : SOCK_DGRAM, 0);
 
         if (sockfd < 0) {
                 fprintf(stderr, "socket() failed: %s\n", strerror(errno));
@@ -289,25 +1061,97 @@ main (int argc, char **argv)
                 exit(EXIT_FAILURE);
         }
 
-        if (is_tcp && (listen(sockfd, 1) != 0)) {
+        if (transport == PKT_TRANSPORT_TCP && (listen(sockfd, 1) != 0)) {
                 fprintf(stderr, "listen() failed: %s\n", strerror(errno));
                 exit(EXIT_FAILURE);
         }
 
+        if (transport == PKT_TRANSPORT_PACKET) {
+                /*
+                 * UDP socket stays bound (so no ICMP port unreachable is sent
+                 * back), but it's never read: keep its buffer minimal
+                 */
+                opt = 0;
+                setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &opt, sizeof(opt));
+
+                if (tpacket_ring_open(&tp_ring, transport_arg, port, tp_block_size,
+                                      tp_block_nr, tp_retire_tov) != 0)
+                        exit(EXIT_FAILURE);
+
+                tp_ring.verbose = verbose;
+                engine = PKT_ENGINE_CLASSIC;
+        }
+
+        if (rx.busy_poll) {
+                if (engine != PKT_ENGINE_CLASSIC) {
+                        fprintf(stderr, "Busy poll uses classic engine\n");
+                        engine = PKT_ENGINE_CLASSIC;
+                }
+
+                if (transport == PKT_TRANSPORT_UDP)
+                        busy_poll_setup(sockfd);
+        }
+
+        if (engine != PKT_ENGINE_CLASSIC) {
+                if (uring_init(&uring, PRCVR_URING_ENTRIES,
+                               engine == PKT_ENGINE_URING_SQPOLL) != 0) {
+                        fprintf(stderr, "io_uring is not available (%s), falling back to classic engine\n",
+                                strerror(errno));
+                        engine = PKT_ENGINE_CLASSIC;
+                } else if (uring_buf_ring_setup(&uring, &uring_bufs, 0, PRCVR_URING_BUFS,
+                                                PRCVR_URING_BUF_SIZE) != 0) {
+                        fprintf(stderr, "io_uring buffer ring setup failed (%s), falling back to classic engine\n",
+                                strerror(errno));
+                        uring_exit(&uring);
+                        engine = PKT_ENGINE_CLASSIC;
+                }
+        }
+
+        /* listener never blocks in accept() or read(), see counted_read() */
+        if (transport == PKT_TRANSPORT_TCP || engine == PKT_ENGINE_CLASSIC)
+                nonblock_setup(sockfd);
+
+        tp_ring.wake_fd = rx.stop_fd;
+
+ start:
+        if (feedback_interval && transport != PKT_TRANSPORT_TCP) {
+                bzero(&feedback_sa, sizeof(feedback_sa));
+                feedback_sa.sin_family = AF_INET;
+                feedback_sa.sin_port = htons(feedback_port);
+
+                if (inet_pton(AF_INET, feedback_addr, &feedback_sa.sin_addr) != 1) {
+                        fprintf(stderr, "inet_pton() failed for '%s'\n", feedback_addr);
+                        exit(EINVAL);
+                }
+
+                if ((feedback_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+                        fprintf(stderr, "socket() failed: %s\n", strerror(errno));
+                        exit(EXIT_FAILURE);
+                }
+        }
+
         sigemptyset(&signals);
         sigaddset(&signals, SIGINT);
         sigaddset(&signals, SIGTERM);
 
         pthread_sigmask(SIG_BLOCK, &signals, NULL);
 
-        if (pthread_create(&listener_t, NULL,
-                           is_tcp ? pkt_listener_tcp : pkt_listener_udp,
-                           NULL) != 0)         {
-                fprintf(stderr, "pthread_create() failed: %s\n", strerror(errno));
+        if ((listener = calloc(1, sizeof(*listener))) == NULL) {
+                fprintf(stderr, "calloc()\n");
                 exit(EXIT_FAILURE);
         }
 
-        if (pthread_create(&processor_t, NULL, pkt_processor, NULL) != 0) {
+        if (pktio_rx_start(&rx) != 0 ||
+            pktio_thread_create(&rx.listener,
+                                transport == PKT_TRANSPORT_PACKET ? pkt_listener_packet :
+                                engine != PKT_ENGINE_CLASSIC ? pkt_listener_uring :
+                                transport == PKT_TRANSPORT_TCP ? pkt_listener_tcp :
+                                transport == PKT_TRANSPORT_UDP ? pkt_listener_udp :
+                                pkt_listener_shm, listener) != 0)
+                exit(EXIT_FAILURE);
+
+        if (feedback_interval &&
+            pthread_create(&reporter_t, NULL, pkt_reporter, NULL) != 0) {
                 fprintf(stderr, "pthread_create() failed: %s\n", strerror(errno));
                 exit(EXIT_FAILURE);
         }
@@ -321,7 +1165,6 @@ main (int argc, char **argv)
                 case SIGTERM:
                 case SIGINT:
                         fprintf(stderr, "got SIGTERM, cleaning up\n");
-                        is_terminating = 1;
                         goto out;
                 default:
                         fprintf(stderr, "got signal(%d), ignoring..\n", signal);
@@ -330,8 +1173,47 @@ main (int argc, char **argv)
         }
 
  out:
-        pthread_join(processor_t, NULL);
-        ring_buffer_print_stats(&ring_buf);
+        /* listener returns right away, then pipeline drains (or abandons) what it got */
+        pktio_rx_shutdown(&rx);
+
+        if (transport == PKT_TRANSPORT_SHM)
+                shm_ring_wake(&shm_ring);
+
+        pthread_join(rx.listener.t, NULL);
+        free(listener);
+
+        if (feedback_interval)
+                pthread_join(reporter_t, NULL);
+
+        /* sender blocked on full ring fails now instead of waiting for the drain */
+        if (transport == PKT_TRANSPORT_SHM)
+                shm_ring_disconnect(&shm_ring);
+
+        pktio_rx_stop(&rx);
+
+        if (transport == PKT_TRANSPORT_SHM)
+                shm_ring_close(&shm_ring);
+
+        pktio_rx_print_stats(&rx, stdout);
+
+        if (trace_path)
+                pktio_rx_write_trace(&rx, trace_path, "pkt_receiver");
+
+        if (record_path) {
+                fprintf(stdout, "RECORDED %lu %s\n", recorder.recs, record_path);
+                capture_writer_close(&recorder);
+        }
+
+        if (transport == PKT_TRANSPORT_PACKET) {
+                tpacket_ring_print_stats(&tp_ring);
+                tpacket_ring_close(&tp_ring);
+        } else if (transport != PKT_TRANSPORT_SHM) {
+                if (engine != PKT_ENGINE_CLASSIC)
+                        engine_stats.syscalls += uring.enter_calls;
+
+                engine_stats_print(stdout, engine, &engine_stats);
+        }
+
         exit(EXIT_SUCCESS);
 }
 
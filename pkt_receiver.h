@@ -12,5 +12,32 @@
 /* Processing options */
 #define PRCVR_RING_SIZE 16  /* Ring buffer size */
 #define PRCVR_DELAY 15    /* Delay on buffer processing (in milliseconds) */
+#define PRCVR_MAX_AGE 0   /* Expire packets queued for longer (in milliseconds), 0: never */
+#define PRCVR_BURST 32    /* Max packets queued/processed per ring lock round trip */
+#define PRCVR_READ_BUF_SIZE (256 * 1024) /* TCP read buffer (classic engine) */
+
+/* Receive pipeline */
+#define PRCVR_PIPELINE_SPLIT 0     /* Verify stage on its own thread (fused into listener otherwise) */
+#define PRCVR_PARSE_RING_SIZE 1024 /* Ring between parse and verify stages (power of 2) */
+#define PRCVR_TRACE_EVERY 100      /* Trace every N-th packet (--trace) */
+
+/* Shutdown */
+#define PRCVR_ABANDON 0     /* Throw queued packets away on stop (process them otherwise) */
+#define PRCVR_DRAIN_MSEC 0  /* Give up processing them after (in milliseconds), 0: never */
+
+/* Traffic classes */
+#define PRCVR_DRR_QUANTUM (sizeof(struct pkt_header) + PSENDER_DATA_MAX_SIZE) /* bytes per weight unit */
+
+/* Busy poll mode */
+#define PRCVR_BUSY_POLL_USEC 50  /* SO_BUSY_POLL: usecs to busy poll device queue in read() */
+
+/* Feedback reports (non-TCP transports send them to side UDP port) */
+#define PRCVR_FEEDBACK_ADDR "127.0.0.1"
+#define PRCVR_FEEDBACK_PORT 31338
+
+/* io_uring engine options */
+#define PRCVR_URING_ENTRIES 64     /* Submission queue size */
+#define PRCVR_URING_BUFS 256       /* Number of provided receive buffers (power of 2) */
+#define PRCVR_URING_BUF_SIZE 4096  /* Size of provided receive buffer */
 
 #endif
@@ -11,40 +11,126 @@
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
-#include "atomic_io.h"
+#include "capture.h"
+#include "engine.h"
 #include "md5.h"
 #include "pkt_sender.h"
+#include "pktio.h"
+#include "rate_ctl.h"
+#include "shm_ring.h"
+#include "trace.h"
+#include "transport.h"
+#include "uring.h"
+#include "zerocopy.h"
 
-static int sockfd = -1;
-static int urandomfd = -1;
+/* generator and transports (socket, shm, v2 frames), see pktio.h */
+static struct pktio_tx tx;
 
 static int verbose = 0;
 
-static int is_tcp = PSENDER_USE_TCP;
-
-static const char *ipaddr = PSENDER_IPADDR;
-static uint16_t port = PSENDER_PORT;
-static struct sockaddr_in sa;
-
-static uint16_t bufsize = PSENDER_DATA_SIZE;
 static unsigned int numpkts = PSENDER_NUM_PKTS;
 static unsigned int wait_time = PSENDER_WAIT_TIME;
 static unsigned long interval = PSENDER_INTERVAL;
 
-/* XXX: just to supress -Wincompatible-pointer-types for atomicio */
-ssize_t my_write (int fd, void *buf, size_t count) {
-        return write(fd, (const void *)buf, count);
-}
+/* adaptive mode: send rate is driven by receiver reports */
+static int adaptive = 0;
+static struct rate_ctl rate_ctl;
+static double rate_inc = PSENDER_RATE_INC;
+static uint16_t feedback_port = PSENDER_FEEDBACK_PORT;
+static int feedback_fd = -1;
+static uint8_t feedback_buf[sizeof(struct pkt_report) * 16];
+static size_t feedback_len = 0;
+
+static const char *replay_path = NULL;
+static double replay_speed = PSENDER_REPLAY_SPEED;
+
+static enum pkt_engine engine = PKT_ENGINE_CLASSIC;
+
+/* sampled packet lifecycle trace, see trace.h */
+static const char *trace_path = NULL;
+static unsigned int trace_every_n = PSENDER_TRACE_EVERY;
+static struct trace_buf trace;
+
+/* prebuilt payloads (random data, checksum computed once), reused round robin */
+struct pool_buf {
+        uint8_t buf[PSENDER_DATA_MAX_SIZE];
+        struct md5_csum cs;
+        int inflight;           /* zerocopy sends kernel still holds pages of */
+};
+
+static struct pool_buf *pool = NULL;
+static unsigned int pool_size = 0;
+static unsigned int pool_next = 0;
+static int32_t pool_cur = -1;
+
+/* MSG_ZEROCOPY sends of pool payloads */
+static int zerocopy = 0;
+static struct zc_tracker zc;
+
+/* io_uring engine: packets are queued into slots and sent in batches */
+struct uring_slot {
+        struct pkt_header h;
+        uint8_t buf[PSENDER_DATA_MAX_SIZE];
+};
+
+static struct uring uring;
+static struct uring_slot *uring_slots = NULL;
+static struct io_uring_sqe *uring_last_sqe = NULL;
+static unsigned int uring_batch = PSENDER_URING_BATCH;
+static unsigned int uring_queued = 0;
+
+/* long only options */
+enum {
+        OPT_RATE_INC = 256,
+        OPT_FEEDBACK_PORT,
+        OPT_FRAME_SIZE,
+        OPT_FLUSH_USEC,
+        OPT_POOL,
+        OPT_CLASS_MIX,
+        OPT_TRACE,
+        OPT_TRACE_EVERY,
+};
+
+static const struct option long_options[] = {
+        { "help",      no_argument,       NULL, 'h' },
+        { "verbose",   no_argument,       NULL, 'v' },
+        { "udp",       no_argument,       NULL, 'u' },
+        { "transport", required_argument, NULL, 't' },
+        { "addr",      required_argument, NULL, 's' },
+        { "port",      required_argument, NULL, 'p' },
+        { "length",    required_argument, NULL, 'l' },
+        { "num",       required_argument, NULL, 'n' },
+        { "interval",  required_argument, NULL, 'i' },
+        { "wait",      required_argument, NULL, 'w' },
+        { "engine",    required_argument, NULL, 'e' },
+        { "batch",     required_argument, NULL, 'b' },
+        { "replay",    required_argument, NULL, 'R' },
+        { "speed",     required_argument, NULL, 'x' },
+        { "adaptive",  no_argument,       NULL, 'A' },
+        { "rate-inc",  required_argument, NULL, OPT_RATE_INC },
+        { "feedback-port", required_argument, NULL, OPT_FEEDBACK_PORT },
+        { "proto",     required_argument, NULL, 'V' },
+        { "frame-size", required_argument, NULL, OPT_FRAME_SIZE },
+        { "flush-usec", required_argument, NULL, OPT_FLUSH_USEC },
+        { "zerocopy",  no_argument,       NULL, 'Z' },
+        { "pool",      required_argument, NULL, OPT_POOL },
+        { "class",     required_argument, NULL, 'c' },
+        { "class-mix", required_argument, NULL, OPT_CLASS_MIX },
+        { "trace",     required_argument, NULL, OPT_TRACE },
+        { "trace-every", required_argument, NULL, OPT_TRACE_EVERY },
+        { NULL, 0, NULL, 0 }
+};
 
 static void
 usage (int ret)
 {
         fprintf(stderr, "Usage:\n");
-        fprintf(stderr, "\t%s  [-h] [-v] [-u] [-s IPADDR] [-p PORTNUM] [-l BUFLEN] [-n PKTNUM] [-i MSECS] [-w SECS]\n\n",
+        fprintf(stderr, "\t%s  [-h] [-v] [-u] [-t TRANSPORT] [-s IPADDR] [-p PORTNUM] [-l BUFLEN] [-n PKTNUM] [-i MSECS] [-w SECS] [-e ENGINE] [-b BATCH] [-R FILE [-x SPEED]] [-A] [-V VERSION] [-Z] [-c CLASS]\n\n",
                 PSENDER_NAME);
 
         fprintf(stderr, "\t%-16s %s\n", "-h", "Display usage information and exit");
@@ -55,6 +141,8 @@ usage (int ret)
         fprintf(stderr, "\t%-16s %s (%u by default)\n", "-P PORTNUM",
                 "Destination port number", PSENDER_PORT);
         fprintf(stderr, "\t%-16s %s\n", "-u", "Use UDP protocl (TCP is used by default)");
+        fprintf(stderr, "\t%-16s %s\n", "-t TRANSPORT",
+                "Transport: tcp, udp or shm:NAME (receiver's shared memory segment NAME)");
 
         fprintf(stderr, "\t%-16s %s (%u by default, the minimum is %u, the maximum is %u)\n", "-l BUFLEN",
                 "Payload buffer size", PSENDER_DATA_SIZE, PSENDER_DATA_MIN_SIZE, PSENDER_DATA_MAX_SIZE);
@@ -68,57 +156,290 @@ usage (int ret)
         fprintf(stderr, "\t%-16s %s (%u by default)\n", "-w SECS",
                 "Interval between batch sending (in secs)", PSENDER_WAIT_TIME);
 
+        fprintf(stderr, "\t%-16s %s\n", "-e ENGINE",
+                "Socket I/O engine: classic (default), uring or uring-sqpoll");
+        fprintf(stderr, "\t%-16s %s (%u by default, used with -i 0)\n", "-b BATCH",
+                "Number of packets submitted at once by uring engine", PSENDER_URING_BATCH);
+
+        fprintf(stderr, "\t%-16s %s\n", "-R FILE",
+                "Replay packets recorded by pkt_receiver -r (-l, -n, -i, -w are ignored)");
+        fprintf(stderr, "\t%-16s %s\n", "-x SPEED",
+                "Replay speed: 1 keeps recorded timing, 10 is 10x faster, 0 is as fast as possible");
+
+        fprintf(stderr, "\t%-16s %s\n", "-A",
+                "Adaptive rate: send PKTNUM packets at rate driven by receiver reports (pkt_receiver -F)");
+        fprintf(stderr, "\t%-16s %s (%u by default)\n", "--rate-inc PPS",
+                "Adaptive rate: additive increase per loss free report", PSENDER_RATE_INC);
+        fprintf(stderr, "\t%-16s %s (%u by default)\n", "--feedback-port PORTNUM",
+                "Adaptive rate: UDP port reports are received on (non-TCP transports)",
+                PSENDER_FEEDBACK_PORT);
+
+        fprintf(stderr, "\t%-16s %s\n", "-V VERSION",
+                "Protocol version: 1 (default) or 2 (TCP only, many packets per frame)");
+        fprintf(stderr, "\t%-16s %s (%u by default)\n", "--frame-size BYTES",
+                "Protocol v2: frame is sent once it would grow over BYTES", PSENDER_FRAME_SIZE);
+        fprintf(stderr, "\t%-16s %s (%u by default)\n", "--flush-usec USECS",
+                "Protocol v2: frame is sent once its first packet is USECS old",
+                PSENDER_FRAME_FLUSH_USEC);
+
+        fprintf(stderr, "\t%-16s %s (%u buffers by default with -Z)\n", "--pool NUM",
+                "Send payloads from pool of NUM prebuilt buffers", PSENDER_POOL_SIZE);
+        fprintf(stderr, "\t%-16s %s\n", "-Z",
+                "Send pool payloads with MSG_ZEROCOPY (TCP and UDP, classic engine)");
+
+        fprintf(stderr, "\t%-16s %s (0..%u, 0 by default)\n", "-c CLASS",
+                "Traffic class of sent packets (-V 2 or shm)", PKT_CLASSES_MAX - 1);
+        fprintf(stderr, "\t%-16s %s\n", "--class-mix W0,W1,...",
+                "Spread packets over classes 0, 1, ... in proportion to weights W0, W1, ...");
+
+        fprintf(stderr, "\t%-16s %s\n", "--trace FILE",
+                "Write send events of sampled packets as Chrome trace JSON (Perfetto)");
+        fprintf(stderr, "\t%-16s %s (%u by default)\n", "--trace-every N",
+                "Trace packets with seqid divisible by N", PSENDER_TRACE_EVERY);
+
         exit(ret);
 }
 
-static inline void
-fill_buffer(uint8_t *buf, size_t bufsize)
+static inline uint64_t
+ts_ns(struct timespec *ts)
 {
-        if (atomicio(read, urandomfd, buf, bufsize) < 0) {
-                fprintf(stderr, "read() /dev/urandom failed: %s\n", strerror(errno));
+        return ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+static void
+pool_init()
+{
+        unsigned int i;
+
+        if ((pool = calloc(pool_size, sizeof(*pool))) == NULL) {
+                fprintf(stderr, "calloc()\n");
                 exit(EXIT_FAILURE);
         }
+
+        for (i = 0; i < pool_size; i++) {
+                if (pktio_tx_random(&tx, pool[i].buf, tx.size) != 0)
+                        exit(EXIT_FAILURE);
+
+                pool[i].cs = md5_csum(pool[i].buf, tx.csum_len);
+        }
 }
 
 static void
-send_pkt()
+pool_done(int32_t owner)
 {
-        struct md5_csum cs;
-        static uint32_t seqid = 0;
-        struct timespec ts;
-        struct pkt_header p;
-        uint8_t payload_buf[PSENDER_DATA_MAX_SIZE];
-
-        bzero(payload_buf, PSENDER_DATA_MAX_SIZE);
+        pool[owner].inflight--;
+}
 
-        fill_buffer(payload_buf, bufsize);
+/* next pool buffer, waits until kernel is done with it */
+static struct pool_buf *
+pool_get()
+{
+        struct pool_buf *b;
 
-        clock_gettime(CLOCK_MONOTONIC, &ts); /* XXX: is CLOCK_REALTIME needed? */
+        pool_cur = pool_next++ % pool_size;
+        b = &pool[pool_cur];
 
-        cs = md5_csum(payload_buf);
+        while (b->inflight > 0)
+                zc_reap(&zc, ZC_WAIT_MSEC, pool_done);
 
-        p.seqid = htonl(seqid);
+        return b;
+}
 
-        p.h0 = htonl(cs.h0);
-        p.h1 = htonl(cs.h1);
-        p.h2 = htonl(cs.h2);
-        p.h3 = htonl(cs.h3);
+/* header is copied, payload is sent with MSG_ZEROCOPY */
+static void
+zc_xmit(struct pkt_header *p, uint8_t *payload, uint16_t size)
+{
+        int ids;
 
-        p.sec = htonl(ts.tv_sec);
-        p.msec = htons((ts.tv_nsec + 1.0e6/2)/1.0e6);
-        p.size = htons(bufsize);
+        if (pktio_tx_write(&tx, tx.fd, p, PKT_HDR_SIZE) != 0)
+                exit(EXIT_FAILURE);
 
-        if (atomicio(my_write, sockfd, &p, sizeof(p)) <= 0 ||
-            atomicio(my_write, sockfd, payload_buf, bufsize) <= 0) {
+        if ((ids = zc_send(&zc, payload, size, pool_cur, pool_done)) < 0) {
                 fprintf(stderr, "write() failed: %s\n", strerror(errno));
-                close(sockfd);
                 exit(EXIT_FAILURE);
         }
 
-        fprintf(stdout, "Sent: %u %lu.%lu\n", seqid, ts.tv_sec, ts.tv_nsec);
+        /* completions are reaped in bulk once pool wraps around to busy buffer */
+        pool[pool_cur].inflight += ids;
+}
+
+static struct io_uring_sqe *
+uring_prep_send(void *buf, size_t len)
+{
+        struct io_uring_sqe *sqe = uring_get_sqe(&uring);
+
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = tx.fd;
+        sqe->addr = (uint64_t)(uintptr_t)buf;
+        sqe->len = len;
+        sqe->msg_flags = (tx.transport == PKT_TRANSPORT_TCP) ? MSG_WAITALL : 0;
+        /* whole batch is a single chain to keep packets ordered */
+        sqe->flags = IOSQE_IO_LINK;
+
+        return sqe;
+}
+
+/* submit queued packets and wait until all of them are sent */
+static void
+uring_send_batch()
+{
+        struct io_uring_cqe *cqe;
+        unsigned int i;
+
+        if (uring_queued == 0)
+                return;
+
+        uring_last_sqe->flags &= ~IOSQE_IO_LINK;
+
+        if (uring_submit_and_wait(&uring, uring_queued * 2) != 0) {
+                fprintf(stderr, "io_uring_enter() failed: %s\n", strerror(errno));
+                exit(EXIT_FAILURE);
+        }
+
+        for (i = 0; i < uring_queued * 2; i++) {
+                while ((cqe = uring_peek_cqe(&uring)) == NULL)
+                        uring_submit_and_wait(&uring, 1);
+
+                if (cqe->res < 0) {
+                        fprintf(stderr, "send() failed: %s\n", strerror(-cqe->res));
+                        exit(EXIT_FAILURE);
+                }
+
+                uring_cqe_seen(&uring);
+        }
+
+        uring_queued = 0;
+}
+
+static void
+pkt_flush()
+{
+        if (tx.proto_version == PKT_FRAME_VERSION) {
+                if (pktio_tx_flush(&tx) != 0)
+                        exit(EXIT_FAILURE);
+        } else if (engine != PKT_ENGINE_CLASSIC)
+                uring_send_batch();
+}
+
+/*
+ * transmit packet (header is in network order), with uring engine both
+ * buffers must stay valid until pkt_flush()
+ */
+static void
+xmit_pkt(struct pkt_header *p, uint8_t *payload, uint16_t size)
+{
+        if (zerocopy) {
+                zc_xmit(p, payload, size);
+        } else if (engine != PKT_ENGINE_CLASSIC) {
+                uring_prep_send(p, PKT_HDR_SIZE);
+                uring_last_sqe = uring_prep_send(payload, size);
+
+                if (++uring_queued == uring_batch)
+                        uring_send_batch();
+        } else {
+                /* v2 frames, shm and plain socket writes */
+                if (pktio_tx_xmit(&tx, p, payload, size) != 0)
+                        exit(EXIT_FAILURE);
+                return;
+        }
+
+        engine_stats_account(&tx.stats, PKT_HDR_SIZE + size);
+}
+
+static void
+send_pkt()
+{
+        struct timespec ts, done;
+        struct pkt_header p, *hp = &p;
+        uint8_t payload_buf[PSENDER_DATA_MAX_SIZE], *pp = payload_buf;
+        struct pool_buf *b;
+
+        if (engine != PKT_ENGINE_CLASSIC) {
+                hp = &uring_slots[uring_queued].h;
+                pp = uring_slots[uring_queued].buf;
+        }
+
+        if (pool_size) {
+                /* pool buffers are never modified, so uring may send them as well */
+                b = pool_get();
+                pp = b->buf;
+                pktio_tx_build_hdr(&tx, hp, &b->cs, &ts);
+        } else if (pktio_tx_build(&tx, hp, pp, &ts) != 0) {
+                exit(EXIT_FAILURE);
+        }
+
+        xmit_pkt(hp, pp, tx.size);
+
+        if (trace_sampled(&trace, tx.seqid)) {
+                clock_gettime(CLOCK_MONOTONIC, &done);
+                trace_pkt(&trace, 'b', "send", tx.seqid, ts_ns(&ts));
+                trace_pkt(&trace, 'e', "send", tx.seqid, ts_ns(&done));
+        }
+
+        fprintf(stdout, "Sent: %u %lu.%lu\n", tx.seqid, ts.tv_sec, ts.tv_nsec);
 
-        seqid++;
+        tx.seqid++;
+}
+
+/* send recorded packets as is, keeping inter-packet timing scaled by speed */
+static void
+replay_pkts()
+{
+        struct capture_reader r;
+        struct capture_rec *rec;
+        struct timespec start, now, ts;
+        uint64_t first_ns = 0, off_ns;
+        uint8_t *payload;
+        int first = 1;
+
+        if (capture_reader_open(&r, replay_path) != 0)
+                exit(EXIT_FAILURE);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        while ((rec = capture_read(&r, &payload)) != NULL) {
+                if (replay_speed > 0) {
+                        if (first) {
+                                first_ns = rec->ts_ns;
+                                first = 0;
+                        }
+
+                        off_ns = (rec->ts_ns > first_ns) ?
+                                (uint64_t)((rec->ts_ns - first_ns) / replay_speed) : 0;
+
+                        ts.tv_sec = start.tv_sec + (start.tv_nsec + off_ns) / 1000000000ULL;
+                        ts.tv_nsec = (start.tv_nsec + off_ns) % 1000000000ULL;
+
+                        clock_gettime(CLOCK_MONOTONIC, &now);
+
+                        /* keep batching while running behind the schedule */
+                        if (now.tv_sec < ts.tv_sec ||
+                            (now.tv_sec == ts.tv_sec && now.tv_nsec < ts.tv_nsec)) {
+                                pkt_flush();
+                                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+                                                       &ts, NULL) == EINTR)
+                                        ;
+                        }
+                }
+
+                if (trace_sampled(&trace, ntohl(rec->h.seqid))) {
+                        clock_gettime(CLOCK_MONOTONIC, &now);
+                        trace_pkt(&trace, 'b', "send", ntohl(rec->h.seqid),
+                                  now.tv_sec * 1000000000ULL + now.tv_nsec);
+                }
+
+                xmit_pkt(&rec->h, payload, ntohs(rec->h.size));
+
+                clock_gettime(CLOCK_MONOTONIC, &now);
 
+                if (trace_sampled(&trace, ntohl(rec->h.seqid)))
+                        trace_pkt(&trace, 'e', "send", ntohl(rec->h.seqid),
+                                  now.tv_sec * 1000000000ULL + now.tv_nsec);
+                fprintf(stdout, "Sent: %u %lu.%lu\n", ntohl(rec->h.seqid), now.tv_sec, now.tv_nsec);
+        }
+
+        pkt_flush();
+        capture_reader_close(&r);
 }
 
 static void
@@ -127,18 +448,154 @@ send_pkts()
         unsigned int i;
 
         for (i = 0; i < numpkts; i++) {
-                if (i != 0)
+                if (i != 0 && interval) {
+                        pkt_flush();
                         usleep(interval * 1000);
+                }
                 send_pkt();
         }
 
+        pkt_flush();
         sleep(wait_time);
 
         for (i = 0; i < numpkts; i++) {
-                if (i != 0)
+                if (i != 0 && interval) {
+                        pkt_flush();
                         usleep(interval * 1000);
+                }
                 send_pkt();
         }
+
+        pkt_flush();
+}
+
+static void
+feedback_report(struct pkt_report *r)
+{
+        pkt_report_swap(r);
+        rate_ctl_update(&rate_ctl, r);
+
+        if (verbose)
+                printf("Report: %u dropped %u occupancy %u/%u rx rate %u, send rate %.0f\n",
+                       r->seq, r->dropped, r->occupancy, r->ring_size, r->rate, rate_ctl.rate);
+}
+
+/* consume all reports available without blocking */
+static void
+feedback_poll()
+{
+        struct pkt_report r;
+        ssize_t ret;
+        size_t off = 0;
+
+        if (tx.transport != PKT_TRANSPORT_TCP) {
+                while (recv(feedback_fd, &r, sizeof(r), MSG_DONTWAIT) == sizeof(r)) {
+                        if (ntohl(r.magic) == PKT_REPORT_MAGIC)
+                                feedback_report(&r);
+                }
+                return;
+        }
+
+        /* reports come back over the TCP connection itself */
+        while ((ret = recv(tx.fd, feedback_buf + feedback_len,
+                           sizeof(feedback_buf) - feedback_len, MSG_DONTWAIT)) > 0) {
+                feedback_len += ret;
+
+                while (feedback_len - off >= sizeof(r)) {
+                        memcpy(&r, feedback_buf + off, sizeof(r));
+
+                        /* resync on magic */
+                        if (ntohl(r.magic) != PKT_REPORT_MAGIC) {
+                                off++;
+                                continue;
+                        }
+
+                        feedback_report(&r);
+                        off += sizeof(r);
+                }
+
+                memmove(feedback_buf, feedback_buf + off, feedback_len - off);
+                feedback_len -= off;
+                off = 0;
+        }
+}
+
+static void
+feedback_open()
+{
+        struct sockaddr_in fsa;
+
+        if (tx.transport == PKT_TRANSPORT_TCP)
+                return;
+
+        if ((feedback_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+                fprintf(stderr, "socket() failed: %s\n", strerror(errno));
+                exit(EXIT_FAILURE);
+        }
+
+        bzero(&fsa, sizeof(fsa));
+        fsa.sin_family = AF_INET;
+        fsa.sin_port = htons(feedback_port);
+        fsa.sin_addr.s_addr = htonl(INADDR_ANY);
+
+        if (bind(feedback_fd, (struct sockaddr *)&fsa, sizeof(fsa)) < 0) {
+                fprintf(stderr, "bind() failed: %s\n", strerror(errno));
+                exit(EXIT_FAILURE);
+        }
+}
+
+/* send `numpkts' packets paced by rate controller */
+static void
+adaptive_send_pkts()
+{
+        struct timespec now, next;
+        uint64_t next_ns, now_ns, last_poll = 0;
+        unsigned int i;
+
+        rate_ctl_init(&rate_ctl, interval ? 1000.0 / interval : PSENDER_RATE_START,
+                      rate_inc, PSENDER_RATE_BETA);
+        feedback_open();
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        next_ns = ts_ns(&now);
+
+        for (i = 0; i < numpkts; i++) {
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                now_ns = ts_ns(&now);
+
+                if (now_ns - last_poll >= PSENDER_FEEDBACK_POLL_NS) {
+                        feedback_poll();
+                        last_poll = now_ns;
+                }
+
+                next_ns += 1e9 / rate_ctl.rate;
+
+                if (next_ns > now_ns) {
+                        pkt_flush();
+                        next.tv_sec = next_ns / 1000000000ULL;
+                        next.tv_nsec = next_ns % 1000000000ULL;
+                        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR)
+                                ;
+                } else if (now_ns - next_ns > PSENDER_RATE_MAX_LAG_NS) {
+                        /* don't burst to catch up after a stall */
+                        next_ns = now_ns;
+                }
+
+                send_pkt();
+        }
+
+        pkt_flush();
+
+        /* let last reports arrive */
+        usleep(PSENDER_FEEDBACK_POLL_NS / 1000 * 100);
+        feedback_poll();
+
+        fprintf(stdout, "RATE max_sustainable_pps=%.0f final_pps=%.0f receiver_pps=%u reports=%lu decreases=%lu\n",
+                rate_ctl.best, rate_ctl.rate, rate_ctl.rx_rate, rate_ctl.reports,
+                rate_ctl.decreases);
+
+        if (feedback_fd >= 0)
+                close(feedback_fd);
 }
 
 int
@@ -146,7 +603,9 @@ main (int argc, char **argv)
 {
         int opt;
 
-        while ((opt = getopt(argc, argv, "hvus:p:l:n:i:w:")) != -1) {
+        pktio_tx_defaults(&tx);
+
+        while ((opt = getopt_long(argc, argv, "hvut:s:p:l:n:i:w:e:b:R:x:AV:Zc:", long_options, NULL)) != -1) {
                 switch (opt) {
                 case 'v':
                         verbose = 1;
@@ -155,10 +614,17 @@ main (int argc, char **argv)
                         usage(EXIT_SUCCESS);
                         break;
                 case 'u':
-                        is_tcp = 0;
+                        tx.transport = PKT_TRANSPORT_UDP;
+                        break;
+                case 't':
+                        if (transport_parse(optarg, &tx.transport, &tx.shm_name) != 0 ||
+                            tx.transport == PKT_TRANSPORT_PACKET) {
+                                fprintf(stderr, "Incorrect transport: %s\n", optarg);
+                                exit(EINVAL);
+                        }
                         break;
                 case 's':
-                        ipaddr = optarg;
+                        tx.addr = optarg;
                         break;
                 case 'p':
                         {
@@ -169,7 +635,7 @@ main (int argc, char **argv)
                                         exit(EINVAL);
                                 }
 
-                                port = (uint16_t) tmp;
+                                tx.port = (uint16_t) tmp;
                                 break;
                         }
                 case 'l':
@@ -182,7 +648,7 @@ main (int argc, char **argv)
                                         exit(EINVAL);
                                 }
 
-                                bufsize = (uint16_t) tmp;
+                                tx.size = (uint16_t) tmp;
                                 break;
                         }
                 case 'w':
@@ -198,6 +664,190 @@ main (int argc, char **argv)
                                 wait_time = tmp;
                                 break;
                         }
+                case 'i':
+                        {
+                                int tmp = -1;
+                                tmp = atoi(optarg);
+
+                                if (tmp < 0) {
+                                        fprintf(stderr, "Incorrect interval: %s\n", optarg);
+                                        exit(EINVAL);
+                                }
+
+                                interval = tmp;
+                                break;
+                        }
+                case 'e':
+                        if (engine_parse(optarg, &engine) != 0) {
+                                fprintf(stderr, "Incorrect engine: %s\n", optarg);
+                                exit(EINVAL);
+                        }
+                        break;
+                case 'b':
+                        {
+                                int tmp = -1;
+                                tmp = atoi(optarg);
+
+                                if (tmp < 1 || tmp > PSENDER_URING_BATCH_MAX) {
+                                        fprintf(stderr, "Incorrect batch size: %s\n", optarg);
+                                        exit(EINVAL);
+                                }
+
+                                uring_batch = tmp;
+                                break;
+                        }
+                case 'R':
+                        replay_path = optarg;
+                        break;
+                case 'A':
+                        adaptive = 1;
+                        break;
+                case 'V':
+                        {
+                                int tmp = atoi(optarg);
+
+                                if (tmp != 1 && tmp != PKT_FRAME_VERSION) {
+                                        fprintf(stderr, "Incorrect protocol version: %s\n", optarg);
+                                        exit(EINVAL);
+                                }
+
+                                tx.proto_version = tmp;
+                                break;
+                        }
+                case 'Z':
+                        zerocopy = 1;
+                        break;
+                case 'c':
+                        {
+                                int tmp = atoi(optarg);
+
+                                if (tmp < 0 || tmp >= PKT_CLASSES_MAX) {
+                                        fprintf(stderr, "Incorrect class: %s\n", optarg);
+                                        exit(EINVAL);
+                                }
+
+                                tx.cls = tmp;
+                                break;
+                        }
+                case OPT_CLASS_MIX:
+                        {
+                                char *arg = optarg, *end;
+                                long tmp;
+
+                                tx.class_mix_n = tx.class_mix_total = 0;
+
+                                do {
+                                        tmp = strtol(arg, &end, 10);
+
+                                        if (end == arg || tmp < 0 || tmp > 65535 ||
+                                            (*end != ',' && *end != '\0') ||
+                                            tx.class_mix_n == PKT_CLASSES_MAX) {
+                                                fprintf(stderr, "Incorrect class mix: %s\n", optarg);
+                                                exit(EINVAL);
+                                        }
+
+                                        tx.class_mix[tx.class_mix_n++] = tmp;
+                                        tx.class_mix_total += tmp;
+                                        arg = end + 1;
+                                } while (*end == ',');
+
+                                if (tx.class_mix_total == 0) {
+                                        fprintf(stderr, "Incorrect class mix: %s\n", optarg);
+                                        exit(EINVAL);
+                                }
+                                break;
+                        }
+                case OPT_TRACE:
+                        trace_path = optarg;
+                        break;
+                case OPT_TRACE_EVERY:
+                        {
+                                int tmp = atoi(optarg);
+
+                                if (tmp < 1) {
+                                        fprintf(stderr, "Incorrect trace sampling: %s\n", optarg);
+                                        exit(EINVAL);
+                                }
+
+                                trace_every_n = tmp;
+                                break;
+                        }
+                case OPT_POOL:
+                        {
+                                int tmp = atoi(optarg);
+
+                                if (tmp < 1 || tmp > PSENDER_POOL_SIZE_MAX) {
+                                        fprintf(stderr, "Incorrect pool size: %s\n", optarg);
+                                        exit(EINVAL);
+                                }
+
+                                pool_size = tmp;
+                                break;
+                        }
+                case OPT_FRAME_SIZE:
+                        {
+                                long tmp = atol(optarg);
+
+                                if (tmp < (long)(sizeof(struct pkt_frame_header) +
+                                                 sizeof(struct pkt_header) + PSENDER_DATA_MAX_SIZE) ||
+                                    tmp > PKT_FRAME_MAX_LEN) {
+                                        fprintf(stderr, "Incorrect frame size: %s\n", optarg);
+                                        exit(EINVAL);
+                                }
+
+                                tx.frame_size = tmp;
+                                break;
+                        }
+                case OPT_FLUSH_USEC:
+                        {
+                                long tmp = atol(optarg);
+
+                                if (tmp < 0) {
+                                        fprintf(stderr, "Incorrect flush deadline: %s\n", optarg);
+                                        exit(EINVAL);
+                                }
+
+                                tx.frame_flush_usec = tmp;
+                                break;
+                        }
+                case OPT_RATE_INC:
+                        {
+                                char *end;
+                                double tmp = strtod(optarg, &end);
+
+                                if (*end != '\0' || tmp <= 0) {
+                                        fprintf(stderr, "Incorrect rate increase: %s\n", optarg);
+                                        exit(EINVAL);
+                                }
+
+                                rate_inc = tmp;
+                                break;
+                        }
+                case OPT_FEEDBACK_PORT:
+                        {
+                                int tmp = -1;
+                                tmp = atoi(optarg);
+                                if (tmp < 1 || tmp > 65535) {
+                                        fprintf(stderr, "Incorrect port number: %s\n", optarg);
+                                        exit(EINVAL);
+                                }
+
+                                feedback_port = (uint16_t) tmp;
+                                break;
+                        }
+                case 'x':
+                        {
+                                char *end;
+                                double tmp = strtod(optarg, &end);
+
+                                if (*end != '\0' || tmp < 0) {
+                                        fprintf(stderr, "Incorrect replay speed: %s\n", optarg);
+                                        exit(EINVAL);
+                                }
+
+                                replay_speed = tmp;
+                                break;
+                        }
                 case 'n':
                         {
                                 int tmp = -1;
@@ -218,51 +868,111 @@ main (int argc, char **argv)
                 }
         }
 
-        urandomfd = open("/dev/urandom", O_RDONLY);
+        if ((tx.cls || tx.class_mix_n) && tx.proto_version != PKT_FRAME_VERSION &&
+            tx.transport != PKT_TRANSPORT_SHM) {
+                fprintf(stderr, "Traffic classes are carried by protocol v2 (-V 2) and shm transport only\n");
+                exit(EINVAL);
+        }
 
-        if (urandomfd < 0) {
-                fprintf(stderr, "open() for '/dev/urandom' failed: %s\n", strerror(errno));
-                exit(EXIT_FAILURE);
+        if (tx.proto_version == PKT_FRAME_VERSION && engine != PKT_ENGINE_CLASSIC) {
+                fprintf(stderr, "Protocol v2 writes whole frames, using classic engine\n");
+                engine = PKT_ENGINE_CLASSIC;
         }
 
-        md5_csum_init(PSENDER_DATA_MAX_SIZE);
+        if (pktio_tx_open(&tx) != 0)
+                exit(EXIT_FAILURE);
 
-        bzero(&sa, sizeof(struct sockaddr_in));
+        if (tx.transport == PKT_TRANSPORT_SHM)
+                engine = PKT_ENGINE_CLASSIC;
 
-        if (inet_pton(AF_INET, ipaddr, &sa.sin_addr) != 1) {
-                fprintf(stderr, "inet_pton() failed for '%s'\n", ipaddr);
-                exit(EINVAL);
-        }
+        if (zerocopy) {
+                if (tx.transport == PKT_TRANSPORT_SHM || tx.proto_version == PKT_FRAME_VERSION ||
+                    replay_path) {
+                        fprintf(stderr, "Zerocopy needs TCP or UDP transport, protocol v1 and generated packets\n");
+                        exit(EINVAL);
+                }
 
-        sa.sin_port = htons(port);
-        sa.sin_family = AF_INET;
+                if (engine != PKT_ENGINE_CLASSIC) {
+                        fprintf(stderr, "Zerocopy uses classic engine\n");
+                        engine = PKT_ENGINE_CLASSIC;
+                }
 
-        sockfd = socket(AF_INET, is_tcp ? SOCK_STREAM : SOCK_DGRAM, 0);
+                if (zc_init(&zc, tx.fd) != 0) {
+                        fprintf(stderr, "SO_ZEROCOPY failed: %s\n", strerror(errno));
+                        exit(EXIT_FAILURE);
+                }
 
-        if (sockfd < 0) {
-                fprintf(stderr, "socket() failed: %s\n", strerror(errno));
-                exit(EXIT_FAILURE);
+                if (pool_size == 0)
+                        pool_size = PSENDER_POOL_SIZE;
         }
 
-        /* try to avoid fragmentation (XXX: think twice) */
-        opt = IP_PMTUDISC_DO;
-        if (setsockopt(sockfd, IPPROTO_IP, IP_MTU_DISCOVER, (const void *) &opt, sizeof(opt)) < 0) {
-                fprintf(stderr, "setsockopt() failed: %s\n", strerror(errno));
-                /* exit(EXIT_FAILURE); */
-        }
+        if (pool_size)
+                pool_init();
 
-        if (connect(sockfd, (struct sockaddr *)&sa, sizeof(struct sockaddr_in)) < 0) {
-                fprintf(stderr, "connect() failed: %s\n", strerror(errno));
-                exit(EXIT_FAILURE);
+        if (engine != PKT_ENGINE_CLASSIC) {
+                uring_slots = calloc(uring_batch, sizeof(struct uring_slot));
+
+                if (uring_slots == NULL) {
+                        fprintf(stderr, "calloc()\n");
+                        exit(EXIT_FAILURE);
+                }
+
+                if (uring_init(&uring, uring_batch * 2, engine == PKT_ENGINE_URING_SQPOLL) != 0) {
+                        fprintf(stderr, "io_uring is not available (%s), falling back to classic engine\n",
+                                strerror(errno));
+                        engine = PKT_ENGINE_CLASSIC;
+                }
         }
 
         if (verbose)
                 printf("Connection established, sending packets..\n");
 
-        send_pkts();
+        if (trace_path)
+                trace_buf_init(&trace, "sender", TRACE_EVENTS_DEFAULT, trace_every_n);
+
+        engine_stats_cpu_start(&tx.stats);
+
+        if (replay_path)
+                replay_pkts();
+        else if (adaptive)
+                adaptive_send_pkts();
+        else
+                send_pkts();
 
-        close(sockfd);
-        close(urandomfd);
+        if (tx.transport != PKT_TRANSPORT_SHM) {
+                if (engine != PKT_ENGINE_CLASSIC) {
+                        tx.stats.syscalls += uring.enter_calls;
+                        uring_exit(&uring);
+                }
+
+                if (zerocopy) {
+                        /* wait for kernel to let all buffers go */
+                        while (zc.completions < zc.sends && zc_reap(&zc, ZC_WAIT_MSEC, pool_done) > 0)
+                                ;
+
+                        tx.stats.syscalls += zc.syscalls;
+                }
+
+                engine_stats_print(stdout, engine, &tx.stats);
+                engine_stats_cpu_print(stdout, zerocopy ? "zerocopy" : pool_size ? "copy-pool" : "copy",
+                                       &tx.stats);
+
+                if (zerocopy)
+                        zc_print_stats(stdout, &zc);
+
+                if (tx.proto_version == PKT_FRAME_VERSION)
+                        fprintf(stdout, "FRAMES frames=%lu records=%lu records/frame=%.1f\n",
+                                tx.frames_sent, tx.frame_records_sent, tx.frames_sent ?
+                                (double)tx.frame_records_sent / tx.frames_sent : 0.0);
+        }
+
+        pktio_tx_close(&tx);
+
+        if (trace_path) {
+                struct trace_buf *bufs[] = { &trace };
+
+                trace_write(trace_path, "pkt_sender", bufs, 1);
+        }
 
         if (verbose)
                 printf("Done\n");
@@ -23,4 +23,30 @@ typedef uint16_t word_t;  /* word is defined as int16 */
 #define PSENDER_INTERVAL 10     /* Interval between packets sending (in milliseconds) */
 #define PSENDER_WAIT_TIME 10    /* Interval between batch sending (in seconds) */
 
+/* io_uring engine options */
+#define PSENDER_URING_BATCH 32        /* Packets submitted with a single io_uring_enter() */
+#define PSENDER_URING_BATCH_MAX 1024
+
+/* Payload pool and zerocopy options */
+#define PSENDER_POOL_SIZE 256
+#define PSENDER_POOL_SIZE_MAX 65536
+
+/* Protocol v2 options */
+#define PSENDER_FRAME_SIZE (64 * 1024)      /* Frame is sent once it would grow over it */
+#define PSENDER_FRAME_FLUSH_USEC 1000       /* ... or once its first packet is that old */
+
+/* Adaptive rate options */
+#define PSENDER_FEEDBACK_PORT 31338
+#define PSENDER_RATE_START 100              /* Initial rate (pps) if interval is 0 */
+#define PSENDER_RATE_INC 10                 /* Additive increase per loss free report (pps) */
+#define PSENDER_RATE_BETA 0.5               /* Multiplicative decrease on drops */
+#define PSENDER_RATE_MAX_LAG_NS 100000000ULL
+#define PSENDER_FEEDBACK_POLL_NS 1000000ULL  /* How often reports are checked */
+
+/* Replay options */
+#define PSENDER_REPLAY_SPEED 1.0   /* Keep recorded inter-packet timing */
+
+/* Tracing */
+#define PSENDER_TRACE_EVERY 100    /* Trace every N-th packet (--trace) */
+
 #endif
@@ -0,0 +1,210 @@
+/*
+ * pkt_stream.h - reassembly of packets (header + payload) from arbitrary
+ * sized chunks of a byte stream (TCP reads, datagrams, io_uring buffers).
+ *
+ * Complete packets are delivered straight from the chunk, only packets
+ * split between chunks are copied into the reassembly buffer.
+ *
+ * pkt_stream_feed_any() handles TCP streams of either protocol version: v1
+ * (bare records) or v2 (records in frames, see proto.h).
+ */
+
+#ifndef _PKT_STREAM_H_
+#define _PKT_STREAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "pkt_sender.h"
+#include "proto.h"
+
+/* `p' is in host order, `buf' is valid during the call only */
+typedef void (*pkt_deliver_fn)(struct pkt_header *p, uint8_t *buf);
+
+struct pkt_stream {
+        uint8_t buf[sizeof(struct pkt_header) + PSENDER_DATA_MAX_SIZE];
+        size_t len;
+
+        /* protocol version (0 until detected) and v2 frame state */
+        int version;
+        uint8_t fh[sizeof(struct pkt_frame_header)];
+        size_t fh_len;
+        uint32_t frame_left;
+        unsigned long frames;
+};
+
+static inline void
+pkt_stream_reset(struct pkt_stream *s)
+{
+        s->len = 0;
+        s->version = 0;
+        s->fh_len = 0;
+        s->frame_left = 0;
+}
+
+/* record header size: v2 records carry class byte, v1 ones (and datagrams) don't */
+static inline size_t
+pkt_stream_hdr_size(struct pkt_stream *s)
+{
+        return (s->version == PKT_FRAME_VERSION) ? PKT_REC_HDR_SIZE : PKT_HDR_SIZE;
+}
+
+static inline int
+pkt_stream_parse_header(uint8_t *data, size_t hdr_size, struct pkt_header *p)
+{
+        p->cls = 0;
+        memcpy(p, data, hdr_size);
+        pkt_header_ntoh(p);
+
+        return (p->size > PSENDER_DATA_MAX_SIZE - 1) ? -1 : 0;
+}
+
+/* returns -1 on protocol mismatch (stream should be dropped) */
+static inline int
+pkt_stream_feed(struct pkt_stream *s, uint8_t *data, size_t len, pkt_deliver_fn deliver)
+{
+        size_t hdr = pkt_stream_hdr_size(s);
+        struct pkt_header p;
+        size_t need, n;
+
+        while (len > 0) {
+                if (s->len == 0) {
+                        if (len < hdr)
+                                goto stash;
+
+                        if (pkt_stream_parse_header(data, hdr, &p) != 0)
+                                return -1;
+
+                        need = hdr + p.size;
+
+                        if (len < need)
+                                goto stash;
+
+                        deliver(&p, data + hdr);
+
+                        data += need;
+                        len -= need;
+                        continue;
+                }
+
+                if (s->len < hdr) {
+                        n = hdr - s->len;
+                        n = (len < n) ? len : n;
+
+                        memcpy(s->buf + s->len, data, n);
+                        s->len += n;
+                        data += n;
+                        len -= n;
+
+                        if (s->len < hdr)
+                                break;
+                }
+
+                if (pkt_stream_parse_header(s->buf, hdr, &p) != 0)
+                        return -1;
+
+                need = hdr + p.size;
+                n = need - s->len;
+                n = (len < n) ? len : n;
+
+                memcpy(s->buf + s->len, data, n);
+                s->len += n;
+                data += n;
+                len -= n;
+
+                if (s->len == need) {
+                        deliver(&p, s->buf + hdr);
+                        s->len = 0;
+                }
+        }
+
+        return 0;
+
+ stash:
+        memcpy(s->buf, data, len);
+        s->len = len;
+
+        return 0;
+}
+
+/* returns -1 on protocol mismatch (stream should be dropped) */
+static inline int
+pkt_stream_feed_any(struct pkt_stream *s, uint8_t *data, size_t len, pkt_deliver_fn deliver)
+{
+        struct pkt_frame_header fh;
+        size_t n;
+
+        /* first bytes of stream tell version, they are kept as frame header part */
+        if (s->version == 0) {
+                n = sizeof(uint32_t) - s->fh_len;
+                n = (len < n) ? len : n;
+
+                memcpy(s->fh + s->fh_len, data, n);
+                s->fh_len += n;
+                data += n;
+                len -= n;
+
+                if (s->fh_len < sizeof(uint32_t))
+                        return 0;
+
+                memcpy(&fh.magic, s->fh, sizeof(uint32_t));
+
+                if (ntohl(fh.magic) == PKT_FRAME_MAGIC) {
+                        s->version = PKT_FRAME_VERSION;
+                } else {
+                        s->version = 1;
+                        s->fh_len = 0;
+
+                        if (pkt_stream_feed(s, s->fh, sizeof(uint32_t), deliver) != 0)
+                                return -1;
+                }
+        }
+
+        if (s->version == 1)
+                return pkt_stream_feed(s, data, len, deliver);
+
+        while (len > 0) {
+                if (s->frame_left == 0) {
+                        n = sizeof(fh) - s->fh_len;
+                        n = (len < n) ? len : n;
+
+                        memcpy(s->fh + s->fh_len, data, n);
+                        s->fh_len += n;
+                        data += n;
+                        len -= n;
+
+                        if (s->fh_len < sizeof(fh))
+                                break;
+
+                        memcpy(&fh, s->fh, sizeof(fh));
+                        s->fh_len = 0;
+
+                        if (ntohl(fh.magic) != PKT_FRAME_MAGIC ||
+                            ntohs(fh.version) != PKT_FRAME_VERSION ||
+                            ntohl(fh.len) > PKT_FRAME_MAX_LEN)
+                                return -1;
+
+                        s->frame_left = ntohl(fh.len);
+                        s->frames++;
+                        continue;
+                }
+
+                n = (len < s->frame_left) ? len : s->frame_left;
+
+                if (pkt_stream_feed(s, data, n, deliver) != 0)
+                        return -1;
+
+                data += n;
+                len -= n;
+                s->frame_left -= n;
+
+                /* records never cross frame boundary */
+                if (s->frame_left == 0 && s->len != 0)
+                        return -1;
+        }
+
+        return 0;
+}
+
+#endif
@@ -0,0 +1,1011 @@
+/*
+ * pktio.c - libpktio, see pktio.h
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "atomic_io.h"
+#include "cpu.h"
+#include "pktio.h"
+
+static const char *trace_ring_names[PKT_CLASSES_MAX] = {
+        "ring 0", "ring 1", "ring 2", "ring 3", "ring 4", "ring 5", "ring 6", "ring 7",
+};
+
+static void
+pktio_thread_defaults (struct pktio_thread *th, const char *name)
+{
+        th->name = name;
+        th->cpu = -1;
+        perf_thread_disable(&th->perf);
+}
+
+void
+pktio_rx_defaults (struct pktio_rx *rx)
+{
+        memset(rx, 0, sizeof(*rx));
+
+        sched_defaults(&rx->sched);
+        rx->sched.max_age_ns = PRCVR_MAX_AGE * 1000000ULL;
+
+        rx->ring_size = PRCVR_RING_SIZE;
+        rx->pipeline_split = PRCVR_PIPELINE_SPLIT;
+        rx->parse_ring_size = PRCVR_PARSE_RING_SIZE;
+        rx->abandon = PRCVR_ABANDON;
+        rx->drain_msec = PRCVR_DRAIN_MSEC;
+        rx->csum_len = PSENDER_DATA_MAX_SIZE;
+        rx->stop_fd = -1;
+
+        pktio_thread_defaults(&rx->listener, "listener");
+        pktio_thread_defaults(&rx->verifier, "verifier");
+        pktio_thread_defaults(&rx->processor, "processor");
+        rx->verify_th = &rx->listener;
+
+        rx->parse_stage.name = "parse";
+        rx->parse_stage.thread = rx->listener.name;
+        rx->verify_stage.name = "verify";
+        rx->verify_stage.thread = rx->listener.name;
+        rx->process_stage.name = "process";
+        rx->process_stage.thread = rx->processor.name;
+
+        rx->perf_read.name = "read";
+        rx->perf_read.t = &rx->listener.perf;
+        rx->perf_checksum.name = "checksum";
+        rx->perf_checksum.t = &rx->listener.perf;
+        rx->perf_enqueue.name = "enqueue";
+        rx->perf_enqueue.t = &rx->listener.perf;
+        rx->perf_dequeue.name = "dequeue";
+        rx->perf_dequeue.t = &rx->processor.perf;
+        rx->perf_process.name = "process";
+        rx->perf_process.t = &rx->processor.perf;
+}
+
+int
+pktio_rx_init (struct pktio_rx *rx)
+{
+        struct pktio_thread *th[] = { &rx->listener, &rx->verifier, &rx->processor };
+        unsigned int i;
+
+        if (rx->process == NULL) {
+                fprintf(stderr, "pktio: process callback is not set\n");
+                return -1;
+        }
+
+        if (rx->csum_len == 0 || rx->csum_len > PSENDER_DATA_MAX_SIZE) {
+                fprintf(stderr, "pktio: checksum length must be 1..%u\n", PSENDER_DATA_MAX_SIZE);
+                return -1;
+        }
+
+        if ((rx->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+                fprintf(stderr, "eventfd() failed: %s\n", strerror(errno));
+                return -1;
+        }
+
+        /* rings are written by listener, but read (and re-read) by processor */
+        sched_init(&rx->sched, rx->ring_size, cpu_node(rx->processor.cpu), rx->hugepages);
+
+        if (rx->pipeline_split) {
+                ring_buffer_init_node(&rx->parse_ring, rx->parse_ring_size,
+                                      cpu_node(rx->verifier.cpu), rx->hugepages);
+                rx->verify_stage.thread = rx->verifier.name;
+                rx->perf_checksum.t = &rx->verifier.perf;
+                rx->perf_enqueue.t = &rx->verifier.perf;
+                rx->verify_th = &rx->verifier;
+        }
+
+        for (i = 0; i < sizeof(th) / sizeof(th[0]); i++) {
+                th[i]->perf_sample = rx->perf_sample;
+
+                if (rx->trace_every && (th[i] != &rx->verifier || rx->pipeline_split))
+                        trace_buf_init(&th[i]->trace, th[i]->name, TRACE_EVENTS_DEFAULT,
+                                       rx->trace_every);
+        }
+
+        return 0;
+}
+
+/* thread entry, pins thread to its CPU (if any) first */
+static void *
+pktio_thread_start (void *data)
+{
+        struct pktio_thread *th = data;
+
+        if (th->cpu >= 0 && cpu_pin_self(th->cpu) != 0)
+                fprintf(stderr, "Can't pin %s thread to CPU %d: %s\n", th->name, th->cpu,
+                        strerror(errno));
+
+        /* counters count calling thread, so they are opened here */
+        if (th->perf_sample && perf_thread_open(&th->perf, th->perf_sample) != 0)
+                fprintf(stderr, "perf counters are not available for %s thread: %s\n",
+                        th->name, strerror(errno));
+
+        return th->fn(th->arg);
+}
+
+int
+pktio_thread_create (struct pktio_thread *th, void *(*fn)(void *), void *arg)
+{
+        th->fn = fn;
+        th->arg = arg;
+
+        if (pthread_create(&th->t, NULL, pktio_thread_start, th) != 0) {
+                fprintf(stderr, "pthread_create() failed: %s\n", strerror(errno));
+                return -1;
+        }
+
+        return 0;
+}
+
+/* shutdown went past its drain deadline: whatever is queued is abandoned */
+static inline int
+pktio_drain_over (struct pktio_rx *rx)
+{
+        uint64_t deadline = __atomic_load_n(&rx->drain_deadline_ns, __ATOMIC_ACQUIRE);
+
+        return deadline != 0 && ring_buffer_now_ns() >= deadline;
+}
+
+/* publish verify stage's burst into class `c' ring */
+static void
+pktio_enqueue_flush_class (struct pktio_rx *rx, unsigned int c)
+{
+        if (rx->burst_n[c] == 0 && rx->burst_dropped[c] == 0)
+                return;
+
+        ring_buffer_enqueue_burst(&rx->sched.cls[c].ring, rx->burst_n[c], rx->burst_dropped[c]);
+        rx->burst_n[c] = 0;
+        rx->burst_dropped[c] = 0;
+}
+
+static void
+pktio_enqueue_flush (struct pktio_rx *rx)
+{
+        int published = 0;
+        unsigned int c;
+
+        for (c = 0; c < rx->sched.nclasses; c++) {
+                published |= rx->burst_n[c] != 0;
+                pktio_enqueue_flush_class(rx, c);
+        }
+
+        if (published)
+                sched_wake(&rx->sched);
+}
+
+/* verify stage: checksum is checked here and only here, returns 1 if it matches */
+static int
+pktio_verify (struct pktio_rx *rx, struct pkt_header *p, uint8_t *buf, uint64_t now)
+{
+        struct trace_buf *trace = &rx->verify_th->trace;
+        int traced = trace_sampled(trace, p->seqid);
+        struct perf_snap snap;
+        struct md5_csum cs;
+        int ok;
+
+        if (traced) {
+                if (rx->pipeline_split)
+                        trace_pkt(trace, 'e', "parse queue", p->seqid, ring_buffer_now_ns());
+
+                trace_pkt(trace, 'b', "verify", p->seqid, ring_buffer_now_ns());
+        }
+
+        perf_begin(&rx->perf_checksum, &snap);
+        cs = md5_csum_n(buf, p->size, rx->csum_len);
+        perf_end(&rx->perf_checksum, &snap);
+
+        if (traced)
+                trace_pkt(trace, 'e', "verify", p->seqid, ring_buffer_now_ns());
+
+        ok = (cs.h0 == p->h0 && cs.h1 == p->h1 && cs.h2 == p->h2 && cs.h3 == p->h3);
+
+        if (rx->verified)
+                rx->verified(rx->arg, p, buf, now, ok);
+
+        return ok;
+}
+
+/* queue verified packet into its class ring, `now' is its receive time */
+static void
+pktio_enqueue (struct pktio_rx *rx, struct pkt_header *p, uint8_t *buf, uint64_t now, int ok)
+{
+        struct trace_buf *trace = &rx->verify_th->trace;
+        struct ring_element_t *slot;
+        struct pkt_class *cls;
+        struct perf_snap snap;
+        unsigned int c;
+
+        perf_begin(&rx->perf_enqueue, &snap);
+
+        c = sched_class_of(&rx->sched, p);
+        cls = &rx->sched.cls[c];
+
+        slot = ring_buffer_burst_slot(&cls->ring, rx->burst_n[c]);
+
+        /* stale packets are the first to go */
+        if (slot == NULL && cls->max_age_ns != 0) {
+                pktio_enqueue_flush_class(rx, c);
+
+                if (ring_buffer_expire(&cls->ring, ring_buffer_now_ns()) > 0)
+                        slot = ring_buffer_burst_slot(&cls->ring, 0);
+        }
+
+        /* drop-head: publish what's staged, then make room by dropping the oldest */
+        if (slot == NULL && cls->overflow == PKT_OVERFLOW_DROP_HEAD) {
+                pktio_enqueue_flush_class(rx, c);
+                ring_buffer_evict(&cls->ring);
+                slot = ring_buffer_burst_slot(&cls->ring, 0);
+        }
+
+        if (slot == NULL) {
+                rx->burst_dropped[c]++;
+        } else {
+                memcpy(&slot->h, p, sizeof(struct pkt_header));
+                memcpy(slot->buf, buf, p->size);
+                slot->queued_ns = now;
+                slot->csum_ok = ok;
+                rx->burst_n[c]++;
+        }
+
+        if (trace_sampled(trace, p->seqid)) {
+                uint64_t ts_ns = ring_buffer_now_ns();
+
+                if (slot == NULL) {
+                        trace_pkt(trace, 'n', "dropped", p->seqid, ts_ns);
+                        trace_pkt(trace, 'e', "pkt", p->seqid, ts_ns);
+                } else {
+                        trace_pkt(trace, 'b', "queued", p->seqid, ts_ns);
+                }
+        }
+
+        if (rx->burst_n[c] == PRCVR_BURST)
+                pktio_enqueue_flush(rx);
+
+        perf_end(&rx->perf_enqueue, &snap);
+}
+
+/* make packets parsed so far visible to next stage */
+void
+pktio_rx_flush (struct pktio_rx *rx)
+{
+        if (!rx->pipeline_split) {
+                pktio_enqueue_flush(rx);
+                return;
+        }
+
+        if (rx->parse_n == 0 && rx->parse_dropped == 0)
+                return;
+
+        rx->parse_stage.dropped += rx->parse_dropped;
+        ring_buffer_enqueue_burst(&rx->parse_ring, rx->parse_n, rx->parse_dropped);
+        rx->parse_n = 0;
+        rx->parse_dropped = 0;
+}
+
+/* parse stage output: packet goes to verify stage */
+void
+pktio_rx_deliver (struct pktio_rx *rx, struct pkt_header *p, uint8_t *buf)
+{
+        struct trace_buf *trace = &rx->listener.trace;
+        struct ring_element_t *slot;
+        uint64_t now;
+
+        now = ring_buffer_now_ns(); /* XXX: CLOCK_REALTIME? (as pkt_sender) */
+
+        stage_account(&rx->parse_stage, 1, 0, now);
+
+        if (trace_sampled(trace, p->seqid)) {
+                trace_pkt(trace, 'b', "pkt", p->seqid, now);
+                trace_pkt(trace, 'n', "rx", p->seqid, now);
+
+                if (rx->pipeline_split)
+                        trace_pkt(trace, 'b', "parse queue", p->seqid, now);
+        }
+
+        if (!rx->pipeline_split) {
+                stage_account(&rx->verify_stage, 1, 0, now);
+                pktio_enqueue(rx, p, buf, now, pktio_verify(rx, p, buf, now));
+                return;
+        }
+
+        /* verify stage has its own thread: just copy packet over to it */
+        if ((slot = ring_buffer_burst_slot(&rx->parse_ring, rx->parse_n)) == NULL) {
+                rx->parse_dropped++;
+
+                if (trace_sampled(trace, p->seqid)) {
+                        trace_pkt(trace, 'n', "dropped", p->seqid, now);
+                        trace_pkt(trace, 'e', "parse queue", p->seqid, now);
+                        trace_pkt(trace, 'e', "pkt", p->seqid, now);
+                }
+        } else {
+                memcpy(&slot->h, p, sizeof(struct pkt_header));
+                memcpy(slot->buf, buf, p->size);
+                slot->queued_ns = now;
+                rx->parse_n++;
+        }
+
+        if (rx->parse_n == PRCVR_BURST)
+                pktio_rx_flush(rx);
+}
+
+/* verify stage thread (split pipeline): checks packets right in parse ring */
+static void *
+pktio_verifier (void *data)
+{
+        struct pktio_rx *rx = data;
+        struct ring_element_t *e;
+        uint32_t i, n, depth;
+
+        for (;;) {
+                if (rx->busy_poll) {
+                        if ((n = ring_buffer_occupancy(&rx->parse_ring)) == 0) {
+                                if (rx->parse_ring.closing)
+                                        break;
+
+                                cpu_relax();
+                                continue;
+                        }
+                } else if ((n = ring_buffer_wait_burst(&rx->parse_ring)) == 0) {
+                        break;
+                }
+
+                if (pktio_drain_over(rx)) {
+                        ring_buffer_abandon(&rx->parse_ring);
+                        continue;
+                }
+
+                depth = n;
+
+                if (n > PRCVR_BURST)
+                        n = PRCVR_BURST;
+
+                stage_account(&rx->verify_stage, n, depth, ring_buffer_now_ns());
+
+                for (i = 0; i < n; i++) {
+                        e = ring_buffer_peek_slot(&rx->parse_ring, i);
+                        pktio_enqueue(rx, &e->h, e->buf, e->queued_ns,
+                                      pktio_verify(rx, &e->h, e->buf, e->queued_ns));
+                }
+
+                ring_buffer_release(&rx->parse_ring, n);
+                pktio_enqueue_flush(rx);
+        }
+
+        return NULL;
+}
+
+void
+pktio_rx_counters (struct pktio_rx *rx, uint32_t *received, uint32_t *dropped,
+                   uint32_t *expired, uint32_t *processed, uint32_t *occupancy, uint32_t *size)
+{
+        sched_counters(&rx->sched, received, dropped, expired, processed, occupancy, size);
+
+        /* parse ring drops (and packets abandoned in it) never got to class rings */
+        if (rx->pipeline_split) {
+                pthread_mutex_lock(&rx->parse_ring.mtx);
+                *received += rx->parse_ring.dropped + rx->parse_ring.abandoned;
+                *dropped += rx->parse_ring.dropped;
+                pthread_mutex_unlock(&rx->parse_ring.mtx);
+        }
+}
+
+/* queue occupancy and loss as counter tracks, sampled by processor at most every 1 ms */
+static void
+pktio_trace_counters (struct pktio_rx *rx, uint64_t now)
+{
+        uint32_t received, dropped, expired, processed, occupancy, size;
+        struct trace_buf *trace = &rx->processor.trace;
+        unsigned int i;
+
+        if (now - rx->trace_counters_ns < 1000000)
+                return;
+
+        rx->trace_counters_ns = now;
+
+        for (i = 0; i < rx->sched.nclasses; i++)
+                trace_counter(trace, trace_ring_names[i],
+                              ring_buffer_occupancy(&rx->sched.cls[i].ring), now);
+
+        pktio_rx_counters(rx, &received, &dropped, &expired, &processed, &occupancy, &size);
+
+        if (rx->pipeline_split)
+                trace_counter(trace, "parse ring", ring_buffer_occupancy(&rx->parse_ring), now);
+
+        trace_counter(trace, "dropped", dropped, now);
+        trace_counter(trace, "expired", expired, now);
+}
+
+/* packets are taken from class rings (as scheduler picks) up to PRCVR_BURST at once */
+static void *
+pktio_processor (void *data)
+{
+        struct pktio_rx *rx = data;
+        struct ring_element_t *batch = rx->batch;
+        struct trace_buf *trace = &rx->processor.trace;
+        struct pkt_header *p;
+        struct pkt_class *cls;
+        struct perf_snap snap;
+        uint32_t i, n;
+        uint64_t age, now;
+        unsigned int c;
+        int traced;
+
+        for (;;) {
+                perf_begin(&rx->perf_dequeue, &snap);
+
+                if (rx->busy_poll) {
+                        n = sched_poll(&rx->sched, batch, PRCVR_BURST, &c);
+                        perf_end(&rx->perf_dequeue, &snap);
+
+                        /* exit once rings are drained, as blocking dequeue does */
+                        if (n == 0) {
+                                if (rx->sched.stop && sched_is_empty(&rx->sched))
+                                        break;
+
+                                cpu_relax();
+                                continue;
+                        }
+                } else {
+                        n = sched_dequeue(&rx->sched, batch, PRCVR_BURST, &c);
+                        perf_end(&rx->perf_dequeue, &snap);
+
+                        if (n == 0)
+                                break;
+                }
+
+                cls = &rx->sched.cls[c];
+                now = ring_buffer_now_ns();
+
+                /* input queue depth as it was right before this batch was taken */
+                stage_account(&rx->process_stage, n, sched_occupancy(&rx->sched) + n, now);
+
+                if (trace->every) {
+                        pktio_trace_counters(rx, now);
+
+                        for (i = 0; i < n; i++) {
+                                if (trace_sampled(trace, batch[i].h.seqid))
+                                        trace_pkt(trace, 'e', "queued", batch[i].h.seqid, now);
+                        }
+                }
+
+                perf_begin(&rx->perf_process, &snap);
+
+                for (i = 0; i < n; i++) {
+                        p = &batch[i].h;
+
+                        /* rest of batch goes along with what's still queued */
+                        if (pktio_drain_over(rx)) {
+                                __atomic_add_fetch(&cls->ring.abandoned, n - i, __ATOMIC_RELAXED);
+                                sched_abandon(&rx->sched);
+                                break;
+                        }
+
+                        traced = trace_sampled(trace, p->seqid);
+
+                        /* may have gone stale while waiting behind the rest of batch */
+                        now = ring_buffer_now_ns();
+                        age = now - batch[i].queued_ns;
+
+                        if (cls->max_age_ns != 0 && age > cls->max_age_ns) {
+                                __atomic_add_fetch(&cls->ring.expired, 1, __ATOMIC_RELAXED);
+
+                                if (traced) {
+                                        trace_pkt(trace, 'n', "expired", p->seqid, now);
+                                        trace_pkt(trace, 'e', "pkt", p->seqid, now);
+                                }
+                                continue;
+                        }
+
+                        hist_add(&cls->age, age);
+
+                        if (traced)
+                                trace_pkt(trace, 'b', "process", p->seqid, now);
+
+                        /* checksum was verified once, by verify stage */
+                        rx->process(rx->arg, p, batch[i].buf, batch[i].csum_ok);
+
+                        /* per packet, so shutdown's drained count doesn't include a batch half done */
+                        __atomic_add_fetch(&cls->ring.processed, 1, __ATOMIC_RELEASE);
+
+                        if (traced) {
+                                now = ring_buffer_now_ns();
+                                trace_pkt(trace, 'e', "process", p->seqid, now);
+                                trace_pkt(trace, 'e', "pkt", p->seqid, now);
+                        }
+                }
+
+                perf_end(&rx->perf_process, &snap);
+        }
+
+        return NULL;
+}
+
+int
+pktio_rx_start (struct pktio_rx *rx)
+{
+        if (rx->pipeline_split && pktio_thread_create(&rx->verifier, pktio_verifier, rx) != 0)
+                return -1;
+
+        if (pktio_thread_create(&rx->processor, pktio_processor, rx) != 0) {
+                if (rx->pipeline_split) {
+                        ring_buffer_close(&rx->parse_ring);
+                        pthread_join(rx->verifier.t, NULL);
+                }
+                return -1;
+        }
+
+        rx->started = 1;
+
+        return 0;
+}
+
+void
+pktio_rx_shutdown (struct pktio_rx *rx)
+{
+        uint32_t received, dropped, expired, occupancy, size;
+        uint64_t one = 1, deadline = 0;
+
+        if (__atomic_exchange_n(&rx->stopping, 1, __ATOMIC_ACQ_REL))
+                return;
+
+        rx->stop_ns = ring_buffer_now_ns();
+
+        /* drain time counts from the signal, not from when listener is joined */
+        pktio_rx_counters(rx, &received, &dropped, &expired, &rx->processed_at_stop, &occupancy,
+                          &size);
+
+        if (rx->abandon)
+                deadline = rx->stop_ns;
+        else if (rx->drain_msec)
+                deadline = rx->stop_ns + rx->drain_msec * 1000000ULL;
+
+        __atomic_store_n(&rx->drain_deadline_ns, deadline, __ATOMIC_RELEASE);
+
+        if (write(rx->stop_fd, &one, sizeof(one)) != sizeof(one))
+                fprintf(stderr, "write() to eventfd failed: %s\n", strerror(errno));
+}
+
+int
+pktio_rx_wait (struct pktio_rx *rx, int fd, short events)
+{
+        struct pollfd pfd[2] = { { fd, events, 0 }, { rx->stop_fd, POLLIN, 0 } };
+
+        while (!pktio_rx_stopping(rx)) {
+                if (poll(pfd, 2, -1) < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        fprintf(stderr, "poll() failed: %s\n", strerror(errno));
+                        return -1;
+                }
+
+                if (pfd[0].revents)
+                        return 1;
+        }
+
+        return 0;
+}
+
+int
+pktio_rx_sleep (struct pktio_rx *rx, unsigned int msec)
+{
+        struct pollfd pfd = { rx->stop_fd, POLLIN, 0 };
+
+        if (!pktio_rx_stopping(rx) && poll(&pfd, 1, msec) < 0 && errno != EINTR)
+                fprintf(stderr, "poll() failed: %s\n", strerror(errno));
+
+        return !pktio_rx_stopping(rx);
+}
+
+void
+pktio_rx_stop (struct pktio_rx *rx)
+{
+        if (!rx->started)
+                return;
+
+        pktio_rx_shutdown(rx);
+
+        /* listener is gone, so what it has staged is published from here */
+        pktio_rx_flush(rx);
+
+        /* verify stage drains parse ring, then processor drains class rings */
+        if (rx->pipeline_split) {
+                ring_buffer_close(&rx->parse_ring);
+                pthread_join(rx->verifier.t, NULL);
+        }
+
+        sched_stop(&rx->sched);
+        pthread_join(rx->processor.t, NULL);
+
+        rx->stopped_ns = ring_buffer_now_ns();
+        rx->started = 0;
+}
+
+/* every packet received is either dropped, expired, processed or abandoned at stop */
+static void
+pktio_rx_print_shutdown (struct pktio_rx *rx, FILE *f)
+{
+        uint32_t received, dropped, expired, processed, occupancy, size;
+        uint32_t abandoned = rx->pipeline_split ? rx->parse_ring.abandoned : 0;
+        unsigned int i;
+
+        pktio_rx_counters(rx, &received, &dropped, &expired, &processed, &occupancy, &size);
+
+        for (i = 0; i < rx->sched.nclasses; i++)
+                abandoned += rx->sched.cls[i].ring.abandoned;
+
+        fprintf(f, "SHUTDOWN mode=%s drain_ms=%u msec=%.1f drained=%u abandoned=%u\n",
+                rx->abandon ? "abandon" : "drain", rx->drain_msec,
+                (rx->stopped_ns - rx->stop_ns) / 1e6, processed - rx->processed_at_stop,
+                abandoned);
+}
+
+void
+pktio_rx_print_stats (struct pktio_rx *rx, FILE *f)
+{
+        struct ring_buffer_t *parse = &rx->parse_ring;
+
+        if (rx->pipeline_split)
+                sched_print_stats(&rx->sched, f, parse->dropped + parse->abandoned,
+                                  parse->dropped, parse->abandoned);
+        else
+                sched_print_stats(&rx->sched, f, 0, 0, 0);
+
+        stage_print(f, &rx->parse_stage);
+        stage_print(f, &rx->verify_stage);
+        stage_print(f, &rx->process_stage);
+
+        if (rx->stopped_ns)
+                pktio_rx_print_shutdown(rx, f);
+
+        if (!rx->perf_sample)
+                return;
+
+        perf_section_print(f, &rx->perf_read, rx->parse_stage.thread, rx->parse_stage.pkts);
+        perf_section_print(f, &rx->perf_checksum, rx->verify_stage.thread,
+                           rx->verify_stage.pkts);
+        perf_section_print(f, &rx->perf_enqueue, rx->verify_stage.thread,
+                           rx->verify_stage.pkts);
+        perf_section_print(f, &rx->perf_dequeue, rx->process_stage.thread,
+                           rx->process_stage.pkts);
+        perf_section_print(f, &rx->perf_process, rx->process_stage.thread,
+                           rx->process_stage.pkts);
+}
+
+int
+pktio_rx_write_trace (struct pktio_rx *rx, const char *path, const char *process)
+{
+        struct trace_buf *bufs[] = {
+                &rx->listener.trace, &rx->verifier.trace, &rx->processor.trace,
+        };
+
+        return trace_write(path, process, bufs, sizeof(bufs) / sizeof(bufs[0]));
+}
+
+void
+pktio_rx_destroy (struct pktio_rx *rx)
+{
+        struct pktio_thread *th[] = { &rx->listener, &rx->verifier, &rx->processor };
+        unsigned int i;
+
+        pktio_rx_stop(rx);
+
+        sched_destroy(&rx->sched);
+
+        if (rx->pipeline_split)
+                ring_buffer_destroy(&rx->parse_ring);
+
+        if (rx->stop_fd >= 0)
+                close(rx->stop_fd);
+
+        rx->stop_fd = -1;
+
+        for (i = 0; i < sizeof(th) / sizeof(th[0]); i++) {
+                perf_thread_close(&th[i]->perf);
+                trace_buf_free(&th[i]->trace);
+        }
+}
+
+void
+pktio_tx_defaults (struct pktio_tx *tx)
+{
+        memset(tx, 0, sizeof(*tx));
+
+        tx->transport = PSENDER_USE_TCP ? PKT_TRANSPORT_TCP : PKT_TRANSPORT_UDP;
+        tx->addr = PSENDER_IPADDR;
+        tx->port = PSENDER_PORT;
+        tx->size = PSENDER_DATA_SIZE;
+        tx->csum_len = PSENDER_DATA_MAX_SIZE;
+        tx->proto_version = 1;
+        tx->frame_size = PSENDER_FRAME_SIZE;
+        tx->frame_flush_usec = PSENDER_FRAME_FLUSH_USEC;
+        tx->frame_len = sizeof(struct pkt_frame_header);
+
+        tx->fd = -1;
+        tx->urandomfd = -1;
+}
+
+static int
+pktio_tx_connect (struct pktio_tx *tx)
+{
+        struct sockaddr_in sa;
+        int opt;
+
+        bzero(&sa, sizeof(struct sockaddr_in));
+
+        if (inet_pton(AF_INET, tx->addr, &sa.sin_addr) != 1) {
+                fprintf(stderr, "inet_pton() failed for '%s'\n", tx->addr);
+                return -1;
+        }
+
+        sa.sin_port = htons(tx->port);
+        sa.sin_family = AF_INET;
+
+        tx->fd = socket(AF_INET, tx->transport == PKT_TRANSPORT_TCP ? SOCK_STREAM : SOCK_DGRAM, 0);
+
+        if (tx->fd < 0) {
+                fprintf(stderr, "socket() failed: %s\n", strerror(errno));
+                return -1;
+        }
+
+        /* try to avoid fragmentation (XXX: think twice) */
+        opt = IP_PMTUDISC_DO;
+        if (setsockopt(tx->fd, IPPROTO_IP, IP_MTU_DISCOVER, (const void *) &opt, sizeof(opt)) < 0)
+                fprintf(stderr, "setsockopt() failed: %s\n", strerror(errno));
+
+        /* frames are coalesced by sender itself, don't let Nagle delay them */
+        opt = 1;
+        if (tx->proto_version == PKT_FRAME_VERSION &&
+            setsockopt(tx->fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt)) < 0)
+                fprintf(stderr, "TCP_NODELAY failed: %s\n", strerror(errno));
+
+        if (connect(tx->fd, (struct sockaddr *)&sa, sizeof(struct sockaddr_in)) < 0) {
+                fprintf(stderr, "connect() failed: %s\n", strerror(errno));
+                close(tx->fd);
+                tx->fd = -1;
+                return -1;
+        }
+
+        return 0;
+}
+
+int
+pktio_tx_open (struct pktio_tx *tx)
+{
+        if (tx->proto_version == PKT_FRAME_VERSION && tx->transport != PKT_TRANSPORT_TCP) {
+                fprintf(stderr, "Protocol v2 is TCP only\n");
+                return -1;
+        }
+
+        if (tx->csum_len < tx->size || tx->csum_len > PSENDER_DATA_MAX_SIZE) {
+                fprintf(stderr, "pktio: checksum length must be %u..%u\n", tx->size,
+                        PSENDER_DATA_MAX_SIZE);
+                return -1;
+        }
+
+        if ((tx->urandomfd = open("/dev/urandom", O_RDONLY)) < 0) {
+                fprintf(stderr, "open() for '/dev/urandom' failed: %s\n", strerror(errno));
+                return -1;
+        }
+
+        if (tx->proto_version == PKT_FRAME_VERSION &&
+            (tx->frame_buf = malloc(tx->frame_size)) == NULL) {
+                fprintf(stderr, "malloc()\n");
+                exit(EXIT_FAILURE);
+        }
+
+        if (tx->transport == PKT_TRANSPORT_SHM)
+                return shm_ring_open(&tx->shm_ring, tx->shm_name);
+
+        return pktio_tx_connect(tx);
+}
+
+int
+pktio_tx_random (struct pktio_tx *tx, uint8_t *buf, size_t len)
+{
+        if (atomicio(read, tx->urandomfd, buf, len) != (ssize_t)len) {
+                fprintf(stderr, "read() /dev/urandom failed: %s\n", strerror(errno));
+                return -1;
+        }
+
+        return 0;
+}
+
+/* deterministic: every class_mix_total packets carry exactly Wi of class i */
+uint8_t
+pktio_tx_class_of (struct pktio_tx *tx, uint32_t id)
+{
+        unsigned int i, pos;
+
+        if (tx->class_mix_n == 0)
+                return tx->cls;
+
+        pos = id % tx->class_mix_total;
+
+        for (i = 0; pos >= tx->class_mix[i]; i++)
+                pos -= tx->class_mix[i];
+
+        return i;
+}
+
+void
+pktio_tx_build_hdr (struct pktio_tx *tx, struct pkt_header *p, struct md5_csum *cs,
+                    struct timespec *ts)
+{
+        clock_gettime(CLOCK_MONOTONIC, ts); /* XXX: is CLOCK_REALTIME needed? */
+
+        p->seqid = htonl(tx->seqid);
+
+        p->h0 = htonl(cs->h0);
+        p->h1 = htonl(cs->h1);
+        p->h2 = htonl(cs->h2);
+        p->h3 = htonl(cs->h3);
+
+        p->sec = htonl(ts->tv_sec);
+        p->msec = htons((ts->tv_nsec + 1.0e6/2)/1.0e6);
+        p->size = htons(tx->size);
+        p->cls = pktio_tx_class_of(tx, tx->seqid);
+}
+
+/* fill payload (PSENDER_DATA_MAX_SIZE bytes) with random data and build header for it */
+int
+pktio_tx_build (struct pktio_tx *tx, struct pkt_header *p, uint8_t *payload,
+                struct timespec *ts)
+{
+        struct md5_csum cs;
+
+        bzero(payload, PSENDER_DATA_MAX_SIZE);
+
+        if (pktio_tx_random(tx, payload, tx->size) != 0)
+                return -1;
+
+        cs = md5_csum(payload, tx->csum_len);
+
+        pktio_tx_build_hdr(tx, p, &cs, ts);
+
+        return 0;
+}
+
+int
+pktio_tx_write (struct pktio_tx *tx, int fd, void *buf, size_t len)
+{
+        uint8_t *s = buf;
+        size_t pos = 0;
+        ssize_t res;
+
+        while (pos < len) {
+                res = write(fd, s + pos, len - pos);
+                tx->stats.syscalls++;
+
+                if (res < 0 && (errno == EINTR || errno == EAGAIN))
+                        continue;
+
+                if (res <= 0) {
+                        fprintf(stderr, "write() failed: %s\n", res == 0 ? strerror(EPIPE) :
+                                strerror(errno));
+                        return -1;
+                }
+
+                pos += res;
+        }
+
+        return 0;
+}
+
+int
+pktio_tx_flush (struct pktio_tx *tx)
+{
+        struct pkt_frame_header *fh = (struct pkt_frame_header *)tx->frame_buf;
+
+        if (tx->proto_version != PKT_FRAME_VERSION || tx->frame_records == 0)
+                return 0;
+
+        fh->magic = htonl(PKT_FRAME_MAGIC);
+        fh->version = htons(PKT_FRAME_VERSION);
+        fh->nrecords = htons(tx->frame_records);
+        fh->len = htonl(tx->frame_len - sizeof(*fh));
+
+        if (pktio_tx_write(tx, tx->fd, tx->frame_buf, tx->frame_len) != 0)
+                return -1;
+
+        tx->frames_sent++;
+        tx->frame_records_sent += tx->frame_records;
+
+        tx->frame_len = sizeof(*fh);
+        tx->frame_records = 0;
+
+        return 0;
+}
+
+static int
+pktio_tx_frame_append (struct pktio_tx *tx, struct pkt_header *p, uint8_t *payload,
+                       uint16_t size)
+{
+        uint64_t now;
+
+        if ((tx->frame_len + PKT_REC_HDR_SIZE + size > tx->frame_size ||
+             tx->frame_records == UINT16_MAX) && pktio_tx_flush(tx) != 0)
+                return -1;
+
+        now = ring_buffer_now_ns();
+
+        if (tx->frame_records == 0)
+                tx->frame_start_ns = now;
+
+        memcpy(tx->frame_buf + tx->frame_len, p, PKT_REC_HDR_SIZE);
+        memcpy(tx->frame_buf + tx->frame_len + PKT_REC_HDR_SIZE, payload, size);
+        tx->frame_len += PKT_REC_HDR_SIZE + size;
+        tx->frame_records++;
+
+        if (now - tx->frame_start_ns >= tx->frame_flush_usec * 1000ULL)
+                return pktio_tx_flush(tx);
+
+        return 0;
+}
+
+int
+pktio_tx_xmit (struct pktio_tx *tx, struct pkt_header *p, uint8_t *payload, uint16_t size)
+{
+        if (tx->proto_version == PKT_FRAME_VERSION) {
+                if (pktio_tx_frame_append(tx, p, payload, size) != 0)
+                        return -1;
+        } else if (tx->transport == PKT_TRANSPORT_SHM) {
+                if (shm_ring_push(&tx->shm_ring, p, payload, size) != 0)
+                        return -1;
+        } else if (pktio_tx_write(tx, tx->fd, p, PKT_HDR_SIZE) != 0 ||
+                   pktio_tx_write(tx, tx->fd, payload, size) != 0) {
+                return -1;
+        }
+
+        engine_stats_account(&tx->stats, PKT_HDR_SIZE + size);
+
+        return 0;
+}
+
+int64_t
+pktio_tx_send (struct pktio_tx *tx, struct timespec *ts)
+{
+        uint8_t payload[PSENDER_DATA_MAX_SIZE];
+        struct pkt_header p;
+
+        if (pktio_tx_build(tx, &p, payload, ts) != 0 ||
+            pktio_tx_xmit(tx, &p, payload, tx->size) != 0)
+                return -1;
+
+        return tx->seqid++;
+}
+
+void
+pktio_tx_close (struct pktio_tx *tx)
+{
+        pktio_tx_flush(tx);
+
+        if (tx->transport == PKT_TRANSPORT_SHM)
+                shm_ring_close(&tx->shm_ring);
+        else if (tx->fd >= 0)
+                close(tx->fd);
+
+        if (tx->urandomfd >= 0)
+                close(tx->urandomfd);
+
+        free(tx->frame_buf);
+
+        tx->fd = -1;
+        tx->urandomfd = -1;
+        tx->frame_buf = NULL;
+}
@@ -0,0 +1,225 @@
+/*
+ * pktio.h - libpktio: receive engine and packet generator of pkt_receiver
+ * and pkt_sender as a library.
+ *
+ * Receive side (struct pktio_rx) takes parsed packets from whatever reads
+ * them (pktio_rx_deliver()), verifies checksums, queues them into traffic
+ * class rings and runs processor thread which hands every packet that
+ * didn't expire to process callback. Send side (struct pktio_tx) builds
+ * packets with random payload and sends them over TCP, UDP or shared memory,
+ * as protocol v1 records or v2 frames.
+ *
+ * All state lives in context objects, so any number of them may run in one
+ * process. Contexts are configured by setting their fields between
+ * pktio_*_defaults() and pktio_rx_init()/pktio_tx_open(). Setup failures
+ * are printed to stderr and returned as -1, except for allocation failures
+ * which exit as everywhere else.
+ */
+
+#ifndef _PKTIO_H_
+#define _PKTIO_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "engine.h"
+#include "md5.h"
+#include "perf.h"
+#include "pkt_receiver.h"
+#include "pkt_sender.h"
+#include "proto.h"
+#include "ring_buffer.h"
+#include "sched.h"
+#include "shm_ring.h"
+#include "stage.h"
+#include "trace.h"
+#include "transport.h"
+
+/* thread of receive pipeline: pinned to `cpu' (if >= 0), with own counters and trace */
+struct pktio_thread {
+        void *(*fn)(void *);
+        void *arg;
+        const char *name;
+        int cpu;
+        unsigned int perf_sample;       /* 0: no hardware counters */
+
+        struct perf_thread perf;
+        struct trace_buf trace;
+        pthread_t t;
+};
+
+/* verify stage: packet received at `now' has been checked, `ok' if checksum matches */
+typedef void (*pktio_verified_fn)(void *arg, struct pkt_header *p, uint8_t *buf, uint64_t now,
+                                  int ok);
+
+/* processor thread: packet is due to be processed */
+typedef void (*pktio_process_fn)(void *arg, struct pkt_header *p, uint8_t *buf, int csum_ok);
+
+struct pktio_rx {
+        /* configuration */
+        uint32_t ring_size;             /* class rings without a size of their own */
+        int pipeline_split;             /* verify stage on its own thread */
+        uint32_t parse_ring_size;
+        int busy_poll;                  /* verifier and processor spin instead of sleeping */
+        int hugepages;
+        unsigned int perf_sample;       /* see perf.h, 0: off */
+        unsigned int trace_every;       /* see trace.h, 0: off */
+        int abandon;                    /* on stop: queued packets are thrown away, not processed */
+        uint32_t drain_msec;            /* on stop: processing them gives up after, 0: never */
+        size_t csum_len;                /* payload is checksummed zero padded to it */
+
+        pktio_verified_fn verified;     /* optional */
+        pktio_process_fn process;
+        void *arg;                      /* passed to callbacks */
+
+        struct pkt_sched sched;         /* classes are set up in it as well */
+
+        /* listener is run by user (pktio_thread_create()), the rest by pktio_rx_start() */
+        struct pktio_thread listener;
+        struct pktio_thread verifier;
+        struct pktio_thread processor;
+        struct pktio_thread *verify_th;
+
+        struct pkt_stage parse_stage;
+        struct pkt_stage verify_stage;
+        struct pkt_stage process_stage;
+
+        struct perf_section perf_read;  /* for listener's own use */
+        struct perf_section perf_checksum;
+        struct perf_section perf_enqueue;
+        struct perf_section perf_dequeue;
+        struct perf_section perf_process;
+
+        /* verify stage's current burst into each class ring */
+        uint32_t burst_n[PKT_CLASSES_MAX];
+        uint32_t burst_dropped[PKT_CLASSES_MAX];
+
+        struct ring_buffer_t parse_ring;
+        uint32_t parse_n;
+        uint32_t parse_dropped;
+
+        /* lifecycle, see pktio_rx_shutdown() */
+        int stop_fd;                    /* eventfd, readable once stopping */
+        int stopping;
+        uint64_t stop_ns;               /* shutdown was requested */
+        uint64_t drain_deadline_ns;     /* 0: none (yet) */
+        uint64_t stopped_ns;            /* pipeline threads are joined */
+        uint32_t processed_at_stop;
+
+        uint64_t trace_counters_ns;
+        int started;
+        struct ring_element_t batch[PRCVR_BURST];
+};
+
+void pktio_rx_defaults (struct pktio_rx *rx);
+int pktio_rx_init (struct pktio_rx *rx);
+int pktio_rx_start (struct pktio_rx *rx);
+
+/* starts `th' running fn(arg), pinned and with counters opened as configured */
+int pktio_thread_create (struct pktio_thread *th, void *(*fn)(void *), void *arg);
+
+/*
+ * single producer (listener) side: packet (header in host order, payload
+ * in `buf', which may be reused on return) goes into pipeline; staged
+ * packets become visible to the rest of it on pktio_rx_flush(), which must
+ * be called before listener may block
+ */
+void pktio_rx_deliver (struct pktio_rx *rx, struct pkt_header *p, uint8_t *buf);
+void pktio_rx_flush (struct pktio_rx *rx);
+
+/*
+ * requests stop, may be called from any thread: pktio_rx_stopping() turns
+ * true and listeners sleeping in pktio_rx_wait() return at once
+ */
+void pktio_rx_shutdown (struct pktio_rx *rx);
+
+static inline int
+pktio_rx_stopping (struct pktio_rx *rx)
+{
+        return __atomic_load_n(&rx->stopping, __ATOMIC_ACQUIRE);
+}
+
+/* listener: waits for `events' on `fd', returns 1 once there, 0 if stopping, -1 on error */
+int pktio_rx_wait (struct pktio_rx *rx, int fd, short events);
+
+/* any helper thread: sleeps for `msec' unless stopping, returns 0 once stopping */
+int pktio_rx_sleep (struct pktio_rx *rx, unsigned int msec);
+
+/*
+ * listener is gone: packets it left in pipeline are processed (until
+ * drain_msec passes since pktio_rx_shutdown()) or abandoned, pipeline threads
+ * are joined
+ */
+void pktio_rx_stop (struct pktio_rx *rx);
+
+/* totals over all rings (parse ring drops included), may be called any time */
+void pktio_rx_counters (struct pktio_rx *rx, uint32_t *received, uint32_t *dropped,
+                        uint32_t *expired, uint32_t *processed, uint32_t *occupancy,
+                        uint32_t *size);
+
+/* STATS, AGE, CLASS, STAGE, PERF and (once stopped) SHUTDOWN lines */
+void pktio_rx_print_stats (struct pktio_rx *rx, FILE *f);
+int pktio_rx_write_trace (struct pktio_rx *rx, const char *path, const char *process);
+
+/* after pktio_rx_stop(), once listener is gone as well */
+void pktio_rx_destroy (struct pktio_rx *rx);
+
+struct pktio_tx {
+        /* configuration */
+        enum pkt_transport transport;
+        const char *addr;
+        uint16_t port;
+        const char *shm_name;           /* shm transport */
+        uint16_t size;                  /* payload size */
+        size_t csum_len;                /* payload is checksummed zero padded to it */
+        int proto_version;              /* 1 or PKT_FRAME_VERSION (TCP only) */
+        size_t frame_size;
+        unsigned long frame_flush_usec;
+
+        /* traffic class: fixed or weighted mix by sequence id */
+        uint8_t cls;
+        unsigned int class_mix[PKT_CLASSES_MAX];
+        unsigned int class_mix_n;
+        unsigned int class_mix_total;
+
+        uint32_t seqid;                 /* of next packet built */
+        int fd;                         /* connected socket */
+        struct engine_stats stats;
+
+        int urandomfd;
+        struct shm_ring_t shm_ring;
+
+        /* protocol v2: records are coalesced into frames, one write() per frame */
+        uint8_t *frame_buf;
+        size_t frame_len;
+        uint16_t frame_records;
+        uint64_t frame_start_ns;
+        unsigned long frames_sent;
+        unsigned long frame_records_sent;
+};
+
+void pktio_tx_defaults (struct pktio_tx *tx);
+int pktio_tx_open (struct pktio_tx *tx);
+
+/* headers are built in network order for packet `seqid' (advanced by caller) */
+void pktio_tx_build_hdr (struct pktio_tx *tx, struct pkt_header *p, struct md5_csum *cs,
+                         struct timespec *ts);
+int pktio_tx_build (struct pktio_tx *tx, struct pkt_header *p, uint8_t *payload,
+                    struct timespec *ts);
+int pktio_tx_random (struct pktio_tx *tx, uint8_t *buf, size_t len);
+uint8_t pktio_tx_class_of (struct pktio_tx *tx, uint32_t seqid);
+
+/* header in network order; v2 records are sent on pktio_tx_flush() or once frame is full */
+int pktio_tx_xmit (struct pktio_tx *tx, struct pkt_header *p, uint8_t *payload, uint16_t size);
+int pktio_tx_flush (struct pktio_tx *tx);
+
+/* builds and sends next packet, returns its seqid or -1 */
+int64_t pktio_tx_send (struct pktio_tx *tx, struct timespec *ts);
+
+/* all of fd, `len' bytes of `buf', write() calls are counted in stats */
+int pktio_tx_write (struct pktio_tx *tx, int fd, void *buf, size_t len);
+
+void pktio_tx_close (struct pktio_tx *tx);
+
+#endif
@@ -1,8 +1,11 @@
 #ifndef _PKT_PROTO_H_
 #define _PKT_PROTO_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include <arpa/inet.h>
+
 struct pkt_header {
         /* sequence id */
         uint32_t seqid;
@@ -19,6 +22,99 @@ struct pkt_header {
 
         /* payload size */
         uint16_t size;
+
+        /* traffic class, 0 is the most important one (see receiver --classes) */
+        uint8_t cls;
+} __attribute__((packed));
+
+/*
+ * v1 wire header is the struct up to cls, byte for byte what it was before
+ * classes, so v1 peers of any age understand each other and v1 packets are
+ * class 0. Class is carried only where layout is versioned: v2 frame
+ * records (whole struct), shm ring slots and capture files.
+ */
+#define PKT_HDR_SIZE offsetof(struct pkt_header, cls)
+#define PKT_REC_HDR_SIZE sizeof(struct pkt_header)
+
+_Static_assert(PKT_HDR_SIZE == 28, "v1 wire header must stay 28 bytes");
+
+#define PKT_CLASSES_MAX 8
+
+/*
+ * Protocol v2 (TCP only): records (v1 header extended by class byte, then
+ * payload) are packed into frames, so many of them are sent and received
+ * with one syscall. Receiver tells versions apart by the first 4 bytes of connection.
+ */
+#define PKT_FRAME_MAGIC 0x50465232 /* "PFR2" */
+#define PKT_FRAME_VERSION 2
+#define PKT_FRAME_MAX_LEN (16 << 20)
+
+struct pkt_frame_header {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t nrecords;
+
+        /* length of records following frame header */
+        uint32_t len;
+} __attribute__((packed));
+
+/* receiver -> sender feedback (all fields in network order on the wire) */
+#define PKT_REPORT_MAGIC 0x50524550 /* "PREP" */
+
+struct pkt_report {
+        uint32_t magic;
+        uint32_t seq;
+
+        /* ring counters since receiver start */
+        uint32_t received;
+        uint32_t dropped;
+        uint32_t processed;
+
+        /* ring occupancy at report time */
+        uint32_t occupancy;
+        uint32_t ring_size;
+
+        /* packets processed per second since previous report */
+        uint32_t rate;
 } __attribute__((packed));
 
+static inline void pkt_header_ntoh (struct pkt_header *p)
+{
+        p->seqid = ntohl(p->seqid);
+        p->sec = ntohl(p->sec);
+        p->msec = ntohs(p->msec);
+        p->size = ntohs(p->size);
+
+        p->h0 = ntohl(p->h0);
+        p->h1 = ntohl(p->h1);
+        p->h2 = ntohl(p->h2);
+        p->h3 = ntohl(p->h3);
+}
+
+static inline void pkt_header_hton (struct pkt_header *p)
+{
+        p->seqid = htonl(p->seqid);
+        p->sec = htonl(p->sec);
+        p->msec = htons(p->msec);
+        p->size = htons(p->size);
+
+        p->h0 = htonl(p->h0);
+        p->h1 = htonl(p->h1);
+        p->h2 = htonl(p->h2);
+        p->h3 = htonl(p->h3);
+}
+
+/* converts in place both ways */
+static inline void pkt_report_swap (struct pkt_report *r)
+{
+        r->magic = htonl(r->magic);
+        r->seq = htonl(r->seq);
+        r->received = htonl(r->received);
+        r->dropped = htonl(r->dropped);
+        r->processed = htonl(r->processed);
+        r->occupancy = htonl(r->occupancy);
+        r->ring_size = htonl(r->ring_size);
+        r->rate = htonl(r->rate);
+}
+
 #endif
@@ -0,0 +1,133 @@
+/*
+ * rate_ctl.h - AIMD send rate controller driven by receiver reports.
+ *
+ * Rate is increased additively after every report interval without ring
+ * drops (unless ring is already half full) and cut multiplicatively on
+ * drops. The maximum sustainable rate is the highest rate which was in
+ * effect for RATE_CTL_STEADY intervals in a row without drops and without
+ * receiver's backlog growing, capped at what receiver processed meanwhile.
+ */
+
+#ifndef _RATE_CTL_H_
+#define _RATE_CTL_H_
+
+#include <stdint.h>
+
+#include "proto.h"
+
+#define RATE_CTL_STEADY 2       /* intervals backlog has to stay flat for */
+
+struct rate_ctl {
+        double rate;            /* current send rate (packets per second) */
+        double min_rate;
+        double max_rate;
+        double inc;             /* additive increase (pps) */
+        double beta;            /* multiplicative decrease factor */
+
+        double best;            /* maximum sustainable rate found */
+        double prev_rate;       /* rate in effect during last report interval */
+
+        uint32_t last_dropped;
+        uint32_t last_received;
+        uint32_t last_seq;
+        uint32_t last_backlog;
+        uint32_t rx_rate;       /* processing rate reported by receiver */
+        unsigned int steady;    /* intervals in a row backlog didn't grow */
+        double steady_rate;     /* lowest rate in effect during them */
+        int have_report;
+
+        unsigned long reports;
+        unsigned long decreases;
+};
+
+static inline void
+rate_ctl_init(struct rate_ctl *c, double start, double inc, double beta)
+{
+        c->rate = c->prev_rate = start;
+        c->min_rate = 1;
+        c->max_rate = 1e7;
+        c->inc = inc;
+        c->beta = beta;
+        c->best = 0;
+        c->last_dropped = 0;
+        c->last_received = 0;
+        c->last_seq = 0;
+        c->last_backlog = 0;
+        c->rx_rate = 0;
+        c->steady = 0;
+        c->steady_rate = 0;
+        c->have_report = 0;
+        c->reports = 0;
+        c->decreases = 0;
+}
+
+/* `r' is in host order */
+static inline void
+rate_ctl_update(struct rate_ctl *c, struct pkt_report *r)
+{
+        uint32_t drops, backlog;
+
+        c->reports++;
+
+        /* packets in processor's batch are out of ring but not processed yet */
+        backlog = r->received - r->dropped - r->processed;
+
+        if (!c->have_report || r->seq <= c->last_seq) {
+                /* first report (or receiver restarted): baseline only */
+                c->have_report = 1;
+                c->last_seq = r->seq;
+                c->last_dropped = r->dropped;
+                c->last_received = r->received;
+                c->last_backlog = backlog;
+                c->prev_rate = c->rate;
+                return;
+        }
+
+        drops = r->dropped - c->last_dropped;
+        c->last_seq = r->seq;
+
+        /*
+         * nothing arrived during interval (e.g. the one after sender is
+         * done), so no evidence either way
+         */
+        if (r->received == c->last_received)
+                return;
+
+        c->rx_rate = r->rate;
+        c->last_dropped = r->dropped;
+        c->last_received = r->received;
+
+        /* backlog building up means rate is above what is processed */
+        if (drops == 0 && backlog <= c->last_backlog) {
+                if (c->steady == 0 || c->prev_rate < c->steady_rate)
+                        c->steady_rate = c->prev_rate;
+
+                if (++c->steady >= RATE_CTL_STEADY) {
+                        double rate = c->steady_rate < r->rate ? c->steady_rate : r->rate;
+
+                        if (rate > c->best)
+                                c->best = rate;
+                }
+        } else {
+                c->steady = 0;
+        }
+
+        if (drops == 0) {
+                if ((uint64_t)r->occupancy * 2 <= r->ring_size)
+                        c->rate += c->inc;
+        } else {
+                c->rate *= c->beta;
+                c->decreases++;
+        }
+
+        c->last_backlog = backlog;
+
+        if (c->rate < c->min_rate)
+                c->rate = c->min_rate;
+        else if (c->rate > c->max_rate)
+                c->rate = c->max_rate;
+
+        c->prev_rate = c->rate;
+}
+
+#endif
@@ -31,17 +31,20 @@
 
 #include <pthread.h>
 #include <stdint.h>
+#include <time.h>
 
+#include "cpu.h"
 #include "pkt_sender.h"
 #include "pkt_receiver.h"
 #include "proto.h"
 
+/* safety net only: closing a ring wakes its consumer right away */
 #define RING_BUFFER_COND_TIMEOUT 2
 
-static volatile int is_terminating = 0;
-
 struct ring_element_t {
         struct pkt_header h;
+        uint64_t queued_ns;     /* CLOCK_MONOTONIC, set by producer */
+        uint8_t csum_ok;        /* set by verify stage */
         uint8_t buf[PSENDER_DATA_MAX_SIZE];
 };
 
@@ -57,23 +60,52 @@ struct ring_buffer_t {
         uint32_t received;
         uint32_t dropped;
         uint32_t processed;
+        uint32_t evicted;       /* ... of dropped, see ring_buffer_evict() */
+        uint32_t expired;       /* not in dropped, see ring_buffer_expire() */
+        uint32_t abandoned;     /* not in dropped, see ring_buffer_abandon() */
+
+        uint64_t max_age_ns;    /* 0: elements never expire */
+        volatile int closing;   /* see ring_buffer_close() */
+        size_t maplen;          /* 0: buffer is calloc()ed */
 
         pthread_mutex_t mtx;
         pthread_cond_t empty;
 };
 
+static inline uint64_t ring_buffer_now_ns(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 static inline void ring_buffer_print_stats(struct ring_buffer_t *ring)
 {
         fprintf(stdout, "STATS %u %u %u\n", ring->received, ring->dropped, ring->processed);
 }
 
-static void ring_buffer_init(struct ring_buffer_t *ring, uint32_t size)
+/*
+ * as ring_buffer_init(), elements are placed on NUMA `node' (-1: any) and in
+ * huge pages if `huge'
+ */
+static inline void
+ring_buffer_init_node(struct ring_buffer_t *ring, uint32_t size, int node, int huge)
 {
+        pthread_condattr_t attr;
+
         ring->tail_index = 0;
         ring->head_index = 0;
         ring->received = 0;
         ring->processed = 0;
         ring->dropped = 0;
+        ring->evicted = 0;
+        ring->expired = 0;
+        ring->abandoned = 0;
+        ring->max_age_ns = 0;
+        ring->closing = 0;
+        ring->maplen = 0;
         ring->size = size;
         ring->mask = ring->size - 1;
 
@@ -82,7 +114,11 @@ static void ring_buffer_init(struct ring_buffer_t *ring, uint32_t size)
                 exit(EXIT_FAILURE);
         }
 
-        ring->buffer = calloc(ring->size,sizeof(struct ring_element_t));
+        if (node < 0 && !huge)
+                ring->buffer = calloc(ring->size,sizeof(struct ring_element_t));
+        else
+                ring->buffer = cpu_node_alloc((size_t)ring->size * sizeof(struct ring_element_t),
+                                              node, huge, &ring->maplen);
 
         if (ring->buffer == NULL) {
                 fprintf(stderr, "calloc()\n");
@@ -94,10 +130,32 @@ static void ring_buffer_init(struct ring_buffer_t *ring, uint32_t size)
                 exit(EXIT_FAILURE);
         }
 
-        if (pthread_cond_init(&ring->empty, NULL) != 0) {
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+        if (pthread_cond_init(&ring->empty, &attr) != 0) {
                 fprintf(stderr, "pthread_cond_init()\n");
                 exit(EXIT_FAILURE);
         }
+
+        pthread_condattr_destroy(&attr);
+}
+
+static inline void ring_buffer_init(struct ring_buffer_t *ring, uint32_t size)
+{
+        ring_buffer_init_node(ring, size, -1, 0);
+}
+
+static inline void ring_buffer_destroy(struct ring_buffer_t *ring)
+{
+        if (ring->maplen)
+                munmap(ring->buffer, ring->maplen);
+        else
+                free(ring->buffer);
+
+        ring->buffer = NULL;
+        pthread_mutex_destroy(&ring->mtx);
+        pthread_cond_destroy(&ring->empty);
 }
 
 static inline uint8_t is_ring_buffer_empty(struct ring_buffer_t *ring) {
@@ -108,7 +166,7 @@ static inline uint8_t is_ring_buffer_full(struct ring_buffer_t *ring) {
         return ((ring->head_index - ring->tail_index) & ring->mask) == ring->mask;
 }
 
-static int
+static inline int
 ring_buffer_queue(struct ring_buffer_t *ring, struct pkt_header *p, uint8_t *buf)
 {
         pthread_mutex_lock(&ring->mtx);
@@ -123,6 +181,7 @@ ring_buffer_queue(struct ring_buffer_t *ring, struct pkt_header *p, uint8_t *buf
 
         memcpy(&ring->buffer[ring->head_index].h, p, sizeof(struct pkt_header));
         memcpy(ring->buffer[ring->head_index].buf, buf, p->size);
+        ring->buffer[ring->head_index].queued_ns = ring_buffer_now_ns();
 
         ring->head_index = ((ring->head_index + 1) & ring->mask);
         pthread_cond_broadcast(&ring->empty);
@@ -131,35 +190,320 @@ ring_buffer_queue(struct ring_buffer_t *ring, struct pkt_header *p, uint8_t *buf
         return 0;
 }
 
-static int
+/* returns 1 once ring is empty and closed (see ring_buffer_close()) */
+static inline int
 ring_buffer_dequeue(struct ring_buffer_t *ring, struct pkt_header *p, uint8_t *buf)
 {
         struct timespec ts;
-        int ret;
 
         pthread_mutex_lock(&ring->mtx);
 
         while (is_ring_buffer_empty(ring)) {
-                clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
-                ts.tv_sec += RING_BUFFER_COND_TIMEOUT;
-                ts.tv_nsec = 0;
-                ret = pthread_cond_timedwait(&ring->empty, &ring->mtx, &ts);
-
-                if (ret == ETIMEDOUT && is_terminating) {
+                if (ring->closing) {
+                        pthread_mutex_unlock(&ring->mtx);
                         return 1;
                 }
+
+                clock_gettime(CLOCK_MONOTONIC, &ts);
+                ts.tv_sec += RING_BUFFER_COND_TIMEOUT;
+                pthread_cond_timedwait(&ring->empty, &ring->mtx, &ts);
         }
 
         memcpy(p, &ring->buffer[ring->tail_index].h, sizeof(struct pkt_header));
         memcpy(buf, &ring->buffer[ring->tail_index].buf, p->size);
 
-        ring->tail_index = (ring->tail_index+1) & ring->mask;
+        __atomic_store_n(&ring->tail_index, (ring->tail_index + 1) & ring->mask,
+                         __ATOMIC_RELEASE);
+
+        pthread_mutex_unlock(&ring->mtx);
+
+        return 0;
+}
+
+/*
+ * Burst interface. Single producer fills slots past head in place (consumer
+ * never looks beyond head, so no lock is taken for that) and publishes all of
+ * them with one lock round trip. Consumer takes up to `max' elements at once
+ * and copies them out of the lock (producer never writes between tail and
+ * head).
+ */
+
+/* `i'-th slot of current burst or NULL if ring is full */
+static inline struct ring_element_t *
+ring_buffer_burst_slot(struct ring_buffer_t *ring, uint32_t i)
+{
+        uint32_t tail = __atomic_load_n(&ring->tail_index, __ATOMIC_ACQUIRE);
+
+        if (((ring->head_index + i - tail) & ring->mask) == ring->mask)
+                return NULL;
+
+        return &ring->buffer[(ring->head_index + i) & ring->mask];
+}
+
+/* publish first `n' slots of burst, `dropped' packets didn't fit */
+static inline void
+ring_buffer_enqueue_burst(struct ring_buffer_t *ring, uint32_t n, uint32_t dropped)
+{
+        pthread_mutex_lock(&ring->mtx);
+
+        ring->received += n + dropped;
+        ring->dropped += dropped;
+
+        if (n > 0) {
+                /* spinning consumer reads head without lock */
+                __atomic_store_n(&ring->head_index, (ring->head_index + n) & ring->mask,
+                                 __ATOMIC_RELEASE);
+                pthread_cond_broadcast(&ring->empty);
+        }
+
+        pthread_mutex_unlock(&ring->mtx);
+}
+
+static inline void
+ring_buffer_take(struct ring_buffer_t *ring, struct ring_element_t *elems, uint32_t tail,
+                 uint32_t n)
+{
+        uint32_t i;
+
+        for (i = 0; i < n; i++) {
+                struct ring_element_t *e = &ring->buffer[(tail + i) & ring->mask];
+
+                memcpy(&elems[i].h, &e->h, sizeof(struct pkt_header));
+                memcpy(elems[i].buf, e->buf, e->h.size);
+                elems[i].queued_ns = e->queued_ns;
+                elems[i].csum_ok = e->csum_ok;
+        }
+
+        __atomic_store_n(&ring->tail_index, (tail + n) & ring->mask, __ATOMIC_RELEASE);
+}
+
+/*
+ * waits for ring to become non-empty, returns number of published elements
+ * or 0 if it is empty once closed (see ring_buffer_close())
+ */
+static inline uint32_t
+ring_buffer_wait_burst(struct ring_buffer_t *ring)
+{
+        struct timespec ts;
+        uint32_t n;
+
+        pthread_mutex_lock(&ring->mtx);
+
+        while (is_ring_buffer_empty(ring)) {
+                if (ring->closing) {
+                        pthread_mutex_unlock(&ring->mtx);
+                        return 0;
+                }
+
+                clock_gettime(CLOCK_MONOTONIC, &ts);
+                ts.tv_sec += RING_BUFFER_COND_TIMEOUT;
+                pthread_cond_timedwait(&ring->empty, &ring->mtx, &ts);
+        }
+
+        n = (ring->head_index - ring->tail_index) & ring->mask;
+
+        pthread_mutex_unlock(&ring->mtx);
+
+        return n;
+}
+
+/* producer is done: consumer drains ring and gets 0 from ring_buffer_wait_burst() */
+static inline void
+ring_buffer_close(struct ring_buffer_t *ring)
+{
+        pthread_mutex_lock(&ring->mtx);
+        ring->closing = 1;
+        pthread_cond_broadcast(&ring->empty);
+        pthread_mutex_unlock(&ring->mtx);
+}
+
+/* returns number of elements copied into `elems', 0 once closed and drained */
+static inline uint32_t
+ring_buffer_dequeue_burst(struct ring_buffer_t *ring, struct ring_element_t *elems, uint32_t max)
+{
+        uint32_t n;
+
+        if ((n = ring_buffer_wait_burst(ring)) == 0)
+                return 0;
+
+        if (n > max)
+                n = max;
+
+        ring_buffer_take(ring, elems, ring->tail_index, n);
+
+        return n;
+}
+
+/*
+ * in place consumer: published elements are used right in the ring (slot
+ * `i' counts from tail) and released once done with, no copy is made
+ */
+static inline struct ring_element_t *
+ring_buffer_peek_slot(struct ring_buffer_t *ring, uint32_t i)
+{
+        return &ring->buffer[(ring->tail_index + i) & ring->mask];
+}
+
+static inline void
+ring_buffer_release(struct ring_buffer_t *ring, uint32_t n)
+{
+        __atomic_add_fetch(&ring->processed, n, __ATOMIC_RELAXED);
+        __atomic_store_n(&ring->tail_index, (ring->tail_index + n) & ring->mask,
+                         __ATOMIC_RELEASE);
+}
+
+/*
+ * consumer gives up on what's left in ring (shutdown past its drain
+ * deadline), returns number of elements thrown away
+ */
+static inline uint32_t
+ring_buffer_abandon(struct ring_buffer_t *ring)
+{
+        uint32_t n;
+
+        pthread_mutex_lock(&ring->mtx);
+
+        n = (ring->head_index - ring->tail_index) & ring->mask;
+        __atomic_store_n(&ring->tail_index, ring->head_index, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&ring->abandoned, n, __ATOMIC_RELAXED);
+
+        pthread_mutex_unlock(&ring->mtx);
+
+        return n;
+}
+
+/* lock-free (approximate for anyone but consumer) */
+static inline uint32_t
+ring_buffer_occupancy(struct ring_buffer_t *ring)
+{
+        return (__atomic_load_n(&ring->head_index, __ATOMIC_ACQUIRE) -
+                __atomic_load_n(&ring->tail_index, __ATOMIC_ACQUIRE)) & ring->mask;
+}
+
+/*
+ * drop-head overflow: producer drops oldest published packet to make room
+ * for a new one. Consumer must use ring_buffer_take_budget() on such ring
+ * (elements are copied under the lock then). Returns -1 if nothing to drop.
+ */
+static inline int
+ring_buffer_evict(struct ring_buffer_t *ring)
+{
+        pthread_mutex_lock(&ring->mtx);
+
+        if (is_ring_buffer_empty(ring)) {
+                pthread_mutex_unlock(&ring->mtx);
+                return -1;
+        }
+
+        __atomic_store_n(&ring->tail_index, (ring->tail_index + 1) & ring->mask,
+                         __ATOMIC_RELEASE);
+        ring->dropped++;
+        ring->evicted++;
 
         pthread_mutex_unlock(&ring->mtx);
 
         return 0;
 }
 
+/*
+ * elements are queued in time order, so expired ones (older than max_age_ns
+ * at `now') are always at the tail: they are dropped by moving tail past
+ * them, without being copied out. Called with ring lock held, returns number
+ * of elements expired.
+ */
+static inline uint32_t
+ring_buffer_expire_locked(struct ring_buffer_t *ring, uint64_t now)
+{
+        uint32_t n = 0, tail = ring->tail_index;
+
+        if (ring->max_age_ns == 0)
+                return 0;
+
+        while (tail != ring->head_index &&
+               now - ring->buffer[tail].queued_ns > ring->max_age_ns) {
+                tail = (tail + 1) & ring->mask;
+                n++;
+        }
+
+        if (n > 0) {
+                __atomic_store_n(&ring->tail_index, tail, __ATOMIC_RELEASE);
+                __atomic_add_fetch(&ring->expired, n, __ATOMIC_RELAXED);
+        }
+
+        return n;
+}
+
+/* as above, for producer: full ring may get room without dropping new packet */
+static inline uint32_t
+ring_buffer_expire(struct ring_buffer_t *ring, uint64_t now)
+{
+        uint32_t n;
+
+        pthread_mutex_lock(&ring->mtx);
+        n = ring_buffer_expire_locked(ring, now);
+        pthread_mutex_unlock(&ring->mtx);
+
+        return n;
+}
+
+/*
+ * never blocks, drops expired elements first (if max_age_ns is set), then
+ * takes up to `max' elements while their size (header
+ * included) fits into `budget' bytes, which is decreased accordingly
+ */
+static inline uint32_t
+ring_buffer_take_budget(struct ring_buffer_t *ring, struct ring_element_t *elems, uint32_t max,
+                        int64_t *budget)
+{
+        struct ring_element_t *e;
+        uint32_t n, avail, tail;
+        int64_t cost;
+
+        pthread_mutex_lock(&ring->mtx);
+
+        if (ring->max_age_ns != 0)
+                ring_buffer_expire_locked(ring, ring_buffer_now_ns());
+
+        tail = ring->tail_index;
+        avail = (ring->head_index - tail) & ring->mask;
+
+        for (n = 0; n < max && n < avail; n++) {
+                e = &ring->buffer[(tail + n) & ring->mask];
+                cost = sizeof(struct pkt_header) + e->h.size;
+
+                if (cost > *budget)
+                        break;
+
+                *budget -= cost;
+                memcpy(&elems[n].h, &e->h, sizeof(struct pkt_header));
+                memcpy(elems[n].buf, e->buf, e->h.size);
+                elems[n].queued_ns = e->queued_ns;
+                elems[n].csum_ok = e->csum_ok;
+        }
+
+        __atomic_store_n(&ring->tail_index, (tail + n) & ring->mask, __ATOMIC_RELEASE);
+
+        pthread_mutex_unlock(&ring->mtx);
+
+        return n;
+}
+
+/* never blocks nor takes the lock (spinning consumer), 0 if ring is empty */
+static inline uint32_t
+ring_buffer_poll_burst(struct ring_buffer_t *ring, struct ring_element_t *elems, uint32_t max)
+{
+        uint32_t tail = ring->tail_index;
+        uint32_t n = (__atomic_load_n(&ring->head_index, __ATOMIC_ACQUIRE) - tail) & ring->mask;
+
+        if (n > max)
+                n = max;
+
+        if (n > 0)
+                ring_buffer_take(ring, elems, tail, n);
+
+        return n;
+}
+
 static void ring_buffer_init(struct ring_buffer_t *buffer, uint32_t size);
 static int ring_buffer_queue(struct ring_buffer_t *ring, struct pkt_header *p, uint8_t *buf);
 static int ring_buffer_dequeue(struct ring_buffer_t *ring, struct pkt_header *p, uint8_t *buf);
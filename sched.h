@@ -0,0 +1,378 @@
+/*
+ * sched.h - traffic classes in receiver: one ring per class (own size,
+ * overflow policy and counters) and a scheduler in front of processor.
+ *
+ * The first `nstrict' classes are served in strict priority order, the rest
+ * share what is left by deficit round robin: every visit adds weight times
+ * PRCVR_DRR_QUANTUM bytes to class deficit, packets are taken while they fit
+ * into it. Processor sleeps on scheduler condition variable when all rings
+ * are empty, listener wakes it up after publishing into any of them.
+ *
+ * Packets older than class max age are expired instead of being processed
+ * (see ring_buffer_expire()), ages of processed ones go into per-class
+ * histograms.
+ */
+
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hist.h"
+#include "pkt_receiver.h"
+#include "proto.h"
+#include "ring_buffer.h"
+
+enum pkt_overflow {
+        PKT_OVERFLOW_DROP_TAIL = 0,     /* new packet is dropped */
+        PKT_OVERFLOW_DROP_HEAD,         /* oldest queued packet is dropped */
+};
+
+struct pkt_class {
+        struct ring_buffer_t ring;
+
+        uint32_t ring_size;             /* 0: receiver's -S */
+        uint32_t weight;
+        enum pkt_overflow overflow;
+        uint64_t max_age_ns;            /* 0: pkt_sched max_age_ns */
+
+        int64_t deficit;
+        struct hist age;                /* queue age of processed packets (processor only) */
+};
+
+struct pkt_sched {
+        struct pkt_class cls[PKT_CLASSES_MAX];
+        unsigned int nclasses;
+        unsigned int nstrict;
+        uint64_t max_age_ns;            /* 0: packets never expire */
+
+        unsigned int drr_cur;
+        int drr_fresh;                  /* drr_cur is yet to get its quantum */
+
+        pthread_mutex_t mtx;
+        pthread_cond_t ready;
+        int waiting;
+        volatile int stop;              /* no more packets are coming */
+};
+
+static inline int
+sched_parse_overflow(const char *spec, enum pkt_overflow *o)
+{
+        if (strcmp(spec, "drop-tail") == 0)
+                *o = PKT_OVERFLOW_DROP_TAIL;
+        else if (strcmp(spec, "drop-head") == 0)
+                *o = PKT_OVERFLOW_DROP_HEAD;
+        else
+                return -1;
+
+        return 0;
+}
+
+static inline const char *
+sched_overflow_name(enum pkt_overflow o)
+{
+        return (o == PKT_OVERFLOW_DROP_HEAD) ? "drop-head" : "drop-tail";
+}
+
+/* class parameters may be changed between sched_defaults() and sched_init() */
+static inline void
+sched_defaults(struct pkt_sched *s)
+{
+        unsigned int i;
+
+        memset(s, 0, sizeof(*s));
+        s->nclasses = 1;
+        s->nstrict = 1;
+
+        for (i = 0; i < PKT_CLASSES_MAX; i++)
+                s->cls[i].weight = 1;
+}
+
+static inline void
+sched_init(struct pkt_sched *s, uint32_t ring_size, int node, int huge)
+{
+        pthread_condattr_t attr;
+        unsigned int i;
+
+        if (s->nstrict > s->nclasses)
+                s->nstrict = s->nclasses;
+
+        for (i = 0; i < s->nclasses; i++) {
+                if (s->cls[i].ring_size == 0)
+                        s->cls[i].ring_size = ring_size;
+
+                if (s->cls[i].max_age_ns == 0)
+                        s->cls[i].max_age_ns = s->max_age_ns;
+
+                ring_buffer_init_node(&s->cls[i].ring, s->cls[i].ring_size, node, huge);
+                s->cls[i].ring.max_age_ns = s->cls[i].max_age_ns;
+                hist_init(&s->cls[i].age);
+        }
+
+        s->drr_cur = s->nstrict;
+        s->drr_fresh = 1;
+
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+        if (pthread_mutex_init(&s->mtx, NULL) != 0 ||
+            pthread_cond_init(&s->ready, &attr) != 0) {
+                fprintf(stderr, "pthread_cond_init()\n");
+                exit(EXIT_FAILURE);
+        }
+
+        pthread_condattr_destroy(&attr);
+}
+
+static inline void
+sched_destroy(struct pkt_sched *s)
+{
+        unsigned int i;
+
+        for (i = 0; i < s->nclasses; i++)
+                ring_buffer_destroy(&s->cls[i].ring);
+
+        pthread_mutex_destroy(&s->mtx);
+        pthread_cond_destroy(&s->ready);
+}
+
+static inline unsigned int
+sched_class_of(struct pkt_sched *s, struct pkt_header *p)
+{
+        return (p->cls < s->nclasses) ? p->cls : s->nclasses - 1;
+}
+
+static inline int
+sched_is_empty(struct pkt_sched *s)
+{
+        unsigned int i;
+
+        for (i = 0; i < s->nclasses; i++) {
+                if (ring_buffer_occupancy(&s->cls[i].ring) != 0)
+                        return 0;
+        }
+
+        return 1;
+}
+
+/* packets queued in all rings (lock-free, approximate) */
+static inline uint32_t
+sched_occupancy(struct pkt_sched *s)
+{
+        uint32_t n = 0;
+        unsigned int i;
+
+        for (i = 0; i < s->nclasses; i++)
+                n += ring_buffer_occupancy(&s->cls[i].ring);
+
+        return n;
+}
+
+/* producer is done: processor exits once rings are drained */
+static inline void
+sched_stop(struct pkt_sched *s)
+{
+        pthread_mutex_lock(&s->mtx);
+        s->stop = 1;
+        pthread_cond_broadcast(&s->ready);
+        pthread_mutex_unlock(&s->mtx);
+}
+
+/* processor gives up on packets still queued (shutdown past drain deadline) */
+static inline uint32_t
+sched_abandon(struct pkt_sched *s)
+{
+        uint32_t n = 0;
+        unsigned int i;
+
+        for (i = 0; i < s->nclasses; i++)
+                n += ring_buffer_abandon(&s->cls[i].ring);
+
+        return n;
+}
+
+/* listener: something was published */
+static inline void
+sched_wake(struct pkt_sched *s)
+{
+        pthread_mutex_lock(&s->mtx);
+
+        if (s->waiting)
+                pthread_cond_signal(&s->ready);
+
+        pthread_mutex_unlock(&s->mtx);
+}
+
+static inline void
+sched_drr_next(struct pkt_sched *s)
+{
+        unsigned int ndrr = s->nclasses - s->nstrict;
+
+        s->drr_cur = s->nstrict + (s->drr_cur - s->nstrict + 1) % ndrr;
+        s->drr_fresh = 1;
+}
+
+/*
+ * takes up to `max' packets of one class (stored in `cls'), never blocks;
+ * returns 0 if all rings are empty
+ */
+static inline uint32_t
+sched_poll(struct pkt_sched *s, struct ring_element_t *elems, uint32_t max, unsigned int *cls)
+{
+        unsigned int i, ndrr = s->nclasses - s->nstrict;
+        struct pkt_class *c;
+        int64_t budget;
+        uint32_t n;
+
+        for (i = 0; i < s->nstrict; i++) {
+                budget = INT64_MAX;
+
+                if ((n = ring_buffer_take_budget(&s->cls[i].ring, elems, max, &budget)) > 0) {
+                        *cls = i;
+                        return n;
+                }
+        }
+
+        if (ndrr == 0)
+                return 0;
+
+        /* quantum is at least one max sized packet, so two rounds are enough */
+        for (i = 0; i < 2 * ndrr + 1; i++) {
+                c = &s->cls[s->drr_cur];
+
+                if (ring_buffer_occupancy(&c->ring) == 0) {
+                        c->deficit = 0;
+                        sched_drr_next(s);
+                        continue;
+                }
+
+                if (s->drr_fresh) {
+                        c->deficit += (int64_t)c->weight * PRCVR_DRR_QUANTUM;
+                        s->drr_fresh = 0;
+                }
+
+                /* visit goes on next time if `max' was hit */
+                if ((n = ring_buffer_take_budget(&c->ring, elems, max, &c->deficit)) > 0) {
+                        *cls = s->drr_cur;
+                        return n;
+                }
+
+                sched_drr_next(s);
+        }
+
+        return 0;
+}
+
+/* as sched_poll(), but waits for packets; returns 0 once stopped and drained */
+static inline uint32_t
+sched_dequeue(struct pkt_sched *s, struct ring_element_t *elems, uint32_t max, unsigned int *cls)
+{
+        struct timespec ts;
+        uint32_t n;
+
+        for (;;) {
+                if ((n = sched_poll(s, elems, max, cls)) > 0)
+                        return n;
+
+                pthread_mutex_lock(&s->mtx);
+
+                /* listener wakes us up only while `waiting' is set */
+                s->waiting = 1;
+
+                if (sched_is_empty(s)) {
+                        if (s->stop) {
+                                s->waiting = 0;
+                                pthread_mutex_unlock(&s->mtx);
+                                return 0;
+                        }
+
+                        clock_gettime(CLOCK_MONOTONIC, &ts);
+                        ts.tv_sec += RING_BUFFER_COND_TIMEOUT;
+                        pthread_cond_timedwait(&s->ready, &s->mtx, &ts);
+                }
+
+                s->waiting = 0;
+                pthread_mutex_unlock(&s->mtx);
+        }
+}
+
+/* totals over all classes (for reports), taken under each ring lock */
+static inline void
+sched_counters(struct pkt_sched *s, uint32_t *received, uint32_t *dropped, uint32_t *expired,
+               uint32_t *processed, uint32_t *occupancy, uint32_t *size)
+{
+        struct ring_buffer_t *ring;
+        unsigned int i;
+
+        *received = *dropped = *expired = *processed = *occupancy = *size = 0;
+
+        for (i = 0; i < s->nclasses; i++) {
+                ring = &s->cls[i].ring;
+
+                pthread_mutex_lock(&ring->mtx);
+                *received += ring->received;
+                *dropped += ring->dropped;
+                *expired += __atomic_load_n(&ring->expired, __ATOMIC_RELAXED);
+                *processed += __atomic_load_n(&ring->processed, __ATOMIC_RELAXED);
+                *occupancy += (ring->head_index - ring->tail_index) & ring->mask;
+                *size += ring->size;
+                pthread_mutex_unlock(&ring->mtx);
+        }
+}
+
+/*
+ * `upstream_received' packets never got to class rings, `upstream_dropped'
+ * of them were dropped and `upstream_abandoned' abandoned on the way
+ *
+ * STATS received dropped processed expired abandoned: every packet received
+ * ends up in exactly one of the other four
+ */
+static inline void
+sched_print_stats(struct pkt_sched *s, FILE *f, uint32_t upstream_received,
+                  uint32_t upstream_dropped, uint32_t upstream_abandoned)
+{
+        uint32_t received, dropped, expired, processed, occupancy, size;
+        uint32_t abandoned = upstream_abandoned;
+        struct ring_buffer_t *ring;
+        struct hist age;
+        unsigned int i;
+
+        sched_counters(s, &received, &dropped, &expired, &processed, &occupancy, &size);
+
+        hist_init(&age);
+
+        for (i = 0; i < s->nclasses; i++) {
+                hist_merge(&age, &s->cls[i].age);
+                abandoned += s->cls[i].ring.abandoned;
+        }
+
+        fprintf(f, "STATS %u %u %u %u %u\n", received + upstream_received,
+                dropped + upstream_dropped, processed, expired, abandoned);
+        fprintf(f, "AGE expired=%u p50_us=%.1f p90_us=%.1f p99_us=%.1f p999_us=%.1f "
+                "max_us=%.1f\n", expired, hist_percentile(&age, 0.5) / 1e3,
+                hist_percentile(&age, 0.9) / 1e3, hist_percentile(&age, 0.99) / 1e3,
+                hist_percentile(&age, 0.999) / 1e3, age.max / 1e3);
+
+        if (s->nclasses == 1)
+                return;
+
+        for (i = 0; i < s->nclasses; i++) {
+                ring = &s->cls[i].ring;
+
+                fprintf(f, "CLASS %u %s received=%u dropped=%u evicted=%u expired=%u "
+                        "processed=%u ring=%u weight=%u overflow=%s max_age_ms=%.1f "
+                        "p99_us=%.1f\n", i,
+                        i < s->nstrict ? "strict" : "drr", ring->received, ring->dropped,
+                        ring->evicted, ring->expired, ring->processed, ring->size,
+                        s->cls[i].weight, sched_overflow_name(s->cls[i].overflow),
+                        s->cls[i].max_age_ns / 1e6, hist_percentile(&s->cls[i].age, 0.99) / 1e3);
+        }
+}
+
+#endif
@@ -0,0 +1,342 @@
+/*
+ * shm_ring.h - single producer/single consumer ring of packets living in
+ * POSIX shared memory, used as a same-host transport between pkt_sender and
+ * pkt_receiver (bypasses the socket stack completely).
+ *
+ * Segment layout: struct shm_ring_hdr followed by `size' slots, every slot is
+ * a (network order) struct pkt_header plus payload. Producer owns head_index,
+ * consumer owns tail_index, both are free running counters. Waiting side
+ * sleeps with futex(2) (not process private since the segment is shared
+ * between processes): producer on tail_index, consumer on consumer_wake,
+ * which is bumped by whoever wakes it (producer or shm_ring_wake()), so a
+ * wake-up coming right before it sleeps isn't lost. Consumer clears
+ * consumer_alive once it stops taking packets; producer waiting on full ring
+ * gives up then, or after SHM_RING_WAIT_ROUNDS waits without tail moving
+ * (consumer crashed).
+ */
+
+#ifndef _SHM_RING_H_
+#define _SHM_RING_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "pkt_sender.h"
+#include "proto.h"
+
+#define SHM_RING_MAGIC 0x50534852 /* "PSHR" */
+#define SHM_RING_VERSION 4 /* 2: pkt_header got class field, 3: consumer_alive, 4: consumer_wake */
+#define SHM_RING_SLOTS 1024 /* Number of slots in segment (power of 2) */
+#define SHM_RING_WAIT_MSEC 100 /* futex wait timeout, to re-check termination */
+#define SHM_RING_WAIT_ROUNDS 50 /* full ring waits without progress before producer gives up */
+
+struct shm_slot {
+        struct pkt_header h;
+        uint8_t buf[PSENDER_DATA_MAX_SIZE];
+};
+
+struct shm_ring_hdr {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t size;
+        uint32_t mask;
+        uint32_t slot_size;
+
+        /* written by producer */
+        _Alignas(64) _Atomic uint32_t head_index;
+        _Atomic uint32_t producer_waiting;
+
+        /* written by consumer */
+        _Alignas(64) _Atomic uint32_t tail_index;
+        _Atomic uint32_t consumer_waiting;
+        _Atomic uint32_t consumer_alive;
+
+        /* written by whoever wakes consumer */
+        _Alignas(64) _Atomic uint32_t consumer_wake;
+
+        _Alignas(64) struct shm_slot slots[];
+};
+
+struct shm_ring_t {
+        struct shm_ring_hdr *hdr;
+        size_t len;
+        char name[NAME_MAX];
+        int is_owner;
+        uint32_t wake_seen;     /* consumer: consumer_wake as of last shm_ring_peek() */
+};
+
+static inline int
+shm_futex(_Atomic uint32_t *addr, int op, uint32_t val, const struct timespec *ts)
+{
+        return syscall(SYS_futex, (uint32_t *)addr, op, val, ts, NULL, 0);
+}
+
+static inline size_t
+shm_ring_len(uint32_t size)
+{
+        return sizeof(struct shm_ring_hdr) + (size_t)size * sizeof(struct shm_slot);
+}
+
+static inline void
+shm_ring_set_name(struct shm_ring_t *ring, const char *name)
+{
+        /* shm_open() wants a single leading slash */
+        snprintf(ring->name, sizeof(ring->name), "%s%s", name[0] == '/' ? "" : "/", name);
+}
+
+/* create (receiver side); returns 0 on success */
+static inline int
+shm_ring_create(struct shm_ring_t *ring, const char *name, uint32_t size)
+{
+        int fd;
+
+        if (size == 0 || (size & (size - 1)) != 0) {
+                fprintf(stderr, "shm ring size must be power of 2\n");
+                return -1;
+        }
+
+        shm_ring_set_name(ring, name);
+        ring->len = shm_ring_len(size);
+        ring->is_owner = 1;
+        ring->wake_seen = 0;
+
+        fd = shm_open(ring->name, O_CREAT | O_EXCL | O_RDWR, 0600);
+
+        if (fd < 0 && errno == EEXIST) {
+                /* stale segment of previous run */
+                shm_unlink(ring->name);
+                fd = shm_open(ring->name, O_CREAT | O_EXCL | O_RDWR, 0600);
+        }
+
+        if (fd < 0) {
+                fprintf(stderr, "shm_open('%s') failed: %s\n", ring->name, strerror(errno));
+                return -1;
+        }
+
+        if (ftruncate(fd, ring->len) < 0) {
+                fprintf(stderr, "ftruncate() failed: %s\n", strerror(errno));
+                close(fd);
+                shm_unlink(ring->name);
+                return -1;
+        }
+
+        ring->hdr = mmap(NULL, ring->len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+
+        if (ring->hdr == MAP_FAILED) {
+                fprintf(stderr, "mmap() failed: %s\n", strerror(errno));
+                shm_unlink(ring->name);
+                return -1;
+        }
+
+        ring->hdr->size = size;
+        ring->hdr->mask = size - 1;
+        ring->hdr->slot_size = sizeof(struct shm_slot);
+        ring->hdr->version = SHM_RING_VERSION;
+        atomic_store(&ring->hdr->head_index, 0);
+        atomic_store(&ring->hdr->tail_index, 0);
+        atomic_store(&ring->hdr->producer_waiting, 0);
+        atomic_store(&ring->hdr->consumer_waiting, 0);
+        atomic_store(&ring->hdr->consumer_alive, 1);
+        atomic_store(&ring->hdr->consumer_wake, 0);
+
+        /* magic goes last: segment is valid for producer from now on */
+        atomic_thread_fence(memory_order_release);
+        ring->hdr->magic = SHM_RING_MAGIC;
+
+        return 0;
+}
+
+/* attach to existing segment (sender side); returns 0 on success */
+static inline int
+shm_ring_open(struct shm_ring_t *ring, const char *name)
+{
+        struct shm_ring_hdr hdr;
+        int fd;
+
+        shm_ring_set_name(ring, name);
+        ring->is_owner = 0;
+
+        fd = shm_open(ring->name, O_RDWR, 0);
+
+        if (fd < 0) {
+                fprintf(stderr, "shm_open('%s') failed: %s\n", ring->name, strerror(errno));
+                return -1;
+        }
+
+        if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || hdr.magic != SHM_RING_MAGIC ||
+            hdr.version != SHM_RING_VERSION || hdr.slot_size != sizeof(struct shm_slot)) {
+                fprintf(stderr, "'%s' is not a compatible shm ring\n", ring->name);
+                close(fd);
+                return -1;
+        }
+
+        ring->len = shm_ring_len(hdr.size);
+        ring->hdr = mmap(NULL, ring->len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+
+        if (ring->hdr == MAP_FAILED) {
+                fprintf(stderr, "mmap() failed: %s\n", strerror(errno));
+                return -1;
+        }
+
+        return 0;
+}
+
+/* consumer: no more packets will be taken, producer waiting on full ring fails at once */
+static inline void
+shm_ring_disconnect(struct shm_ring_t *ring)
+{
+        atomic_store(&ring->hdr->consumer_alive, 0);
+        shm_futex(&ring->hdr->tail_index, FUTEX_WAKE, 1, NULL);
+}
+
+static inline void
+shm_ring_close(struct shm_ring_t *ring)
+{
+        if (ring->is_owner)
+                shm_ring_disconnect(ring);
+
+        munmap(ring->hdr, ring->len);
+
+        if (ring->is_owner)
+                shm_unlink(ring->name);
+}
+
+/* any thread: consumer waiting in shm_ring_peek() returns at once */
+static inline void
+shm_ring_wake(struct shm_ring_t *ring)
+{
+        atomic_fetch_add(&ring->hdr->consumer_wake, 1);
+        shm_futex(&ring->hdr->consumer_wake, FUTEX_WAKE, 1, NULL);
+}
+
+/*
+ * producer: copy packet (header is expected in network order) into next free
+ * slot, waits while ring is full. Returns -1 (EPIPE) if consumer is gone.
+ */
+static inline int
+shm_ring_push(struct shm_ring_t *ring, struct pkt_header *p, uint8_t *buf, uint16_t size)
+{
+        struct shm_ring_hdr *hdr = ring->hdr;
+        struct timespec ts = { 0, SHM_RING_WAIT_MSEC * 1000000L };
+        uint32_t head = atomic_load_explicit(&hdr->head_index, memory_order_relaxed);
+        uint32_t tail, last_tail = head - hdr->size;
+        unsigned int rounds = 0;
+        struct shm_slot *slot;
+
+        while (head - (tail = atomic_load_explicit(&hdr->tail_index, memory_order_acquire))
+               == hdr->size) {
+                if (tail != last_tail) {
+                        last_tail = tail;
+                        rounds = 0;
+                }
+
+                if (!atomic_load(&hdr->consumer_alive) || rounds++ == SHM_RING_WAIT_ROUNDS) {
+                        fprintf(stderr, "shm ring '%s': consumer is gone\n", ring->name);
+                        errno = EPIPE;
+                        return -1;
+                }
+
+                atomic_store(&hdr->producer_waiting, 1);
+
+                /* consumer may have moved tail meanwhile */
+                if (atomic_load(&hdr->tail_index) == tail)
+                        shm_futex(&hdr->tail_index, FUTEX_WAIT, tail, &ts);
+
+                atomic_store(&hdr->producer_waiting, 0);
+        }
+
+        slot = &hdr->slots[head & hdr->mask];
+        memcpy(&slot->h, p, sizeof(struct pkt_header));
+        memcpy(slot->buf, buf, size);
+
+        atomic_store_explicit(&hdr->head_index, head + 1, memory_order_release);
+
+        /*
+         * head store goes before waiting flag load (consumer does the reverse
+         * in shm_ring_peek()), otherwise both may miss each other's update
+         */
+        atomic_thread_fence(memory_order_seq_cst);
+
+        if (atomic_load(&hdr->consumer_waiting))
+                shm_ring_wake(ring);
+
+        return 0;
+}
+
+/* consumer: non-blocking check */
+static inline int
+shm_ring_is_empty(struct shm_ring_t *ring)
+{
+        return atomic_load_explicit(&ring->hdr->head_index, memory_order_acquire) ==
+                atomic_load_explicit(&ring->hdr->tail_index, memory_order_relaxed);
+}
+
+/*
+ * consumer: returns pointer to oldest filled slot (valid until
+ * shm_ring_release()) or NULL if ring stayed empty for SHM_RING_WAIT_MSEC
+ * or consumer was woken (since previous call) by shm_ring_wake(), caller
+ * checks why before calling again
+ */
+static inline struct shm_slot *
+shm_ring_peek(struct shm_ring_t *ring)
+{
+        struct shm_ring_hdr *hdr = ring->hdr;
+        struct timespec ts = { 0, SHM_RING_WAIT_MSEC * 1000000L };
+        uint32_t tail = atomic_load_explicit(&hdr->tail_index, memory_order_relaxed);
+        uint32_t head = atomic_load_explicit(&hdr->head_index, memory_order_acquire);
+        uint32_t wake;
+
+        if (head == tail) {
+                wake = atomic_load(&hdr->consumer_wake);
+
+                if (wake != ring->wake_seen) {
+                        ring->wake_seen = wake;
+                        return NULL;
+                }
+
+                atomic_store(&hdr->consumer_waiting, 1);
+
+                /* wake-up after consumer_wake was read fails the wait at once */
+                if (atomic_load(&hdr->head_index) == head)
+                        shm_futex(&hdr->consumer_wake, FUTEX_WAIT, wake, &ts);
+
+                atomic_store(&hdr->consumer_waiting, 0);
+
+                head = atomic_load_explicit(&hdr->head_index, memory_order_acquire);
+
+                if (head == tail)
+                        return NULL;
+        }
+
+        return &hdr->slots[tail & hdr->mask];
+}
+
+static inline void
+shm_ring_release(struct shm_ring_t *ring)
+{
+        struct shm_ring_hdr *hdr = ring->hdr;
+
+        atomic_fetch_add_explicit(&hdr->tail_index, 1, memory_order_release);
+
+        /* as in shm_ring_push(), against producer in it */
+        atomic_thread_fence(memory_order_seq_cst);
+
+        if (atomic_load(&hdr->producer_waiting))
+                shm_futex(&hdr->tail_index, FUTEX_WAKE, 1, NULL);
+}
+
+#endif
@@ -0,0 +1,56 @@
+/*
+ * stage.h - per-stage counters of receive pipeline (parse -> verify ->
+ * process): packets handled, throughput over the stage's active period and
+ * depth of its input queue as seen on every batch it takes. Each stage is
+ * updated by its own thread only and read once it's done.
+ */
+
+#ifndef _STAGE_H_
+#define _STAGE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+struct pkt_stage {
+        const char *name;
+        const char *thread;             /* thread stage runs on */
+
+        uint64_t pkts;
+        uint64_t batches;
+        uint64_t depth_sum;
+        uint32_t depth_max;
+        uint32_t dropped;               /* input queue was full */
+
+        uint64_t first_ns;
+        uint64_t last_ns;
+};
+
+static inline void
+stage_account(struct pkt_stage *st, uint32_t n, uint32_t depth, uint64_t now)
+{
+        if (st->pkts == 0)
+                st->first_ns = now;
+
+        st->last_ns = now;
+        st->pkts += n;
+        st->batches++;
+        st->depth_sum += depth;
+
+        if (depth > st->depth_max)
+                st->depth_max = depth;
+}
+
+static inline void
+stage_print(FILE *f, struct pkt_stage *st)
+{
+        double secs = (st->last_ns - st->first_ns) / 1e9;
+
+        fprintf(f, "STAGE %s thread=%s pkts=%lu pps=%.0f queue_avg=%.1f queue_max=%u "
+                "dropped=%u\n", st->name, st->thread, st->pkts,
+                secs > 0 ? st->pkts / secs : 0.0,
+                st->batches ? (double)st->depth_sum / st->batches : 0.0,
+                st->depth_max, st->dropped);
+}
+
+#endif
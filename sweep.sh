@@ -0,0 +1,297 @@
+#!/bin/bash
+#
+# Parallel parameter sweep for pkt_{sender,receiver}
+#
+# Walks the same pkt_size x num_pkts x ring_size x send_delay x
+# process_delay grid as test.sh (NUM_TESTS repetitions of each point), but
+# runs up to JOBS sender/receiver pairs at once. Every run gets its own
+# port pair (data port and feedback port next to it, never reused within a
+# sweep so TIME_WAIT doesn't get in the way) and its job slot's own set of
+# CPUS_PER_RUN cpus (taskset), so concurrent runs don't share cores.
+#
+# Usage:
+#
+# ./sweep.sh [-u] [-j JOBS] [-c CPUS_PER_RUN] [-P BASE_PORT] [-o OUTDIR] [-t NUM_TESTS]
+#            [-l "PKT_SIZE..."] [-n "NUM_PKTS..."] [-s "RING_SIZE..."] [-i "SEND_DELAY..."]
+#            [-d "PROCESS_DELAY..."] [-w BATCH_WAIT] [-a "RECEIVER_ARGS"] [-A "SENDER_ARGS"]
+#
+# Lists are space separated, e.g. ./sweep.sh -n "500 1000 5000" -s "64 512 4096"
+# (test 9 of doc/tests.md). RECEIVER and SENDER may be overridden from
+# environment (build/ executables by default).
+#
+# OUTDIR gets run.N/ with logs of every run, runs.csv (one line per run)
+# and sweep.csv, sweep.json (one entry per grid point: mean over
+# repetitions and 95% confidence interval half width, Student's t).
+#
+
+BASEPATH="$( cd -- "$(dirname "$0")" >/dev/null 2>&1 ; pwd -P )"
+
+RECEIVER="${RECEIVER:-$BASEPATH/build/pkt_receiver}"
+SENDER="${SENDER:-$BASEPATH/build/pkt_sender}"
+
+# Test 1 of doc/tests.md
+PKT_SIZE="1000"
+NUM_PKTS="30"
+RING_SIZE="8 16 128"
+SEND_DELAY="10 100 1000"
+PROCESS_DELAY="10 100 1000"
+NUM_TESTS=3
+USE_UDP=""
+BATCH_WAIT=1
+
+NCPUS=$(nproc)
+CPUS_PER_RUN=2
+JOBS=""
+BASE_PORT=32000
+OUTDIR="$BASEPATH/sweep.$(date "+%Y%m%d-%H%M%S")"
+RECEIVER_ARGS=""
+SENDER_ARGS=""
+
+# receiver is given this long to start listening
+START_WAIT=1
+
+if [[ ! -x "$RECEIVER" || ! -x "$SENDER" ]]; then
+        echo "$RECEIVER or $SENDER doesn't exist (need to build?)"
+        exit 1
+fi
+
+while [[ "$#" -gt 0 ]]; do
+    case $1 in
+            -u) USE_UDP="-u" ;;
+            -j) JOBS="$2"; shift ;;
+            -c) CPUS_PER_RUN="$2"; shift ;;
+            -P) BASE_PORT="$2"; shift ;;
+            -o) OUTDIR="$2"; shift ;;
+            -t) NUM_TESTS="$2"; shift ;;
+            -l) PKT_SIZE="$2"; shift ;;
+            -n) NUM_PKTS="$2"; shift ;;
+            -s) RING_SIZE="$2"; shift ;;
+            -i) SEND_DELAY="$2"; shift ;;
+            -d) PROCESS_DELAY="$2"; shift ;;
+            -w) BATCH_WAIT="$2"; shift ;;
+            -a) RECEIVER_ARGS="$2"; shift ;;
+            -A) SENDER_ARGS="$2"; shift ;;
+        *) echo "Unknown parameter passed: $1"; exit 1 ;;
+    esac
+    shift
+done
+
+if [[ "$CPUS_PER_RUN" -gt "$NCPUS" ]]; then
+        CPUS_PER_RUN=$NCPUS
+fi
+
+if [[ -z "$JOBS" ]]; then
+        JOBS=$(( NCPUS / CPUS_PER_RUN ))
+        [[ "$JOBS" -lt 1 ]] && JOBS=1
+fi
+
+if [[ $(( JOBS * CPUS_PER_RUN )) -gt "$NCPUS" ]]; then
+        echo "Warning: $JOBS jobs of $CPUS_PER_RUN cpus don't fit $NCPUS cpus, runs will share them"
+fi
+
+PROTO="tcp"
+[[ -n "$USE_UDP" ]] && PROTO="udp"
+
+TASKSET=""
+
+if command -v taskset > /dev/null; then
+        TASKSET="taskset -c"
+else
+        echo "Warning: taskset not found, runs are not pinned"
+fi
+
+mkdir -p "$OUTDIR" || exit 1
+
+# cpus of job slot $1: CPUS_PER_RUN consecutive ones, wrapping around
+function slot_cpus()
+{
+        local first=$(( $1 * CPUS_PER_RUN )) cpus="" i
+
+        for (( i = 0; i < CPUS_PER_RUN; i++ )); do
+                cpus="$cpus${cpus:+,}$(( (first + i) % NCPUS ))"
+        done
+
+        echo $cpus
+}
+
+# run.N/result: one runs.csv line
+function run_test()
+{
+        local idx=$1 rep=$2 slot=$3 pktsize=$4 numpkts=$5 ringsize=$6 send_delay=$7 process_delay=$8
+        local dir="$OUTDIR/run.$idx"
+        local port=$(( BASE_PORT + 2 * (idx % 10000) ))
+        local cpus=$(slot_cpus $slot)
+        local pin="" rpid start end sent status="ok"
+        local received="" dropped="" processed="" expired="" abandoned=""
+
+        [[ -n "$TASKSET" ]] && pin="$TASKSET $cpus"
+
+        mkdir -p "$dir"
+
+        $pin $RECEIVER $USE_UDP -p $port --feedback-port $(( port + 1 )) -S $ringsize \
+                -d $process_delay $RECEIVER_ARGS > "$dir/rcv_out.log" 2> "$dir/rcv_err.log" &
+        rpid=$!
+
+        sleep $START_WAIT
+        start=$(date +%s.%N)
+
+        $pin $SENDER $USE_UDP -p $port --feedback-port $(( port + 1 )) -l $pktsize -n $numpkts \
+                -w $BATCH_WAIT -i $send_delay $SENDER_ARGS > "$dir/snd_out.log" 2> "$dir/snd_err.log" \
+                || status="sender_failed"
+
+        # let in-flight UDP datagrams land, receiver drains its rings on exit
+        sleep 1
+        kill -TERM $rpid 2> /dev/null
+        wait $rpid || status="receiver_failed"
+        end=$(date +%s.%N)
+
+        if grep -q " FAIL$" "$dir/rcv_out.log"; then
+                status="checksum_fail"
+        fi
+
+        sent=$(grep -c "^Sent:" "$dir/snd_out.log")
+        read received dropped processed expired abandoned < <(awk '/^STATS/ { print $2, $3, $4, $5, $6 }' "$dir/rcv_out.log")
+
+        echo "$idx,$rep,$PROTO,$pktsize,$numpkts,$ringsize,$send_delay,$process_delay,$sent,$received,$dropped,$expired,$abandoned,$processed,$(echo "$start $end" | awk '{ printf "%.3f", $2 - $1 }'),$cpus,$port,$status" > "$dir/result"
+}
+
+declare -a slot_pid
+idx=0
+SWEEP_START=$(date +%s)
+
+trap 'echo "Interrupted, killing runs"; kill -KILL 0' INT TERM
+
+echo "$(date "+%Y-%m-%d %H:%M:%S") Sweep into $OUTDIR: $JOBS jobs, $CPUS_PER_RUN cpus each"
+
+for pktsize in $PKT_SIZE; do
+        for numpkts in $NUM_PKTS; do
+                for ringsize in $RING_SIZE; do
+                        for send_delay in $SEND_DELAY; do
+                                for process_delay in $PROCESS_DELAY; do
+                                        for rep in $(seq $NUM_TESTS); do
+                                                # first free job slot, or wait for one
+                                                while :; do
+                                                        for (( slot = 0; slot < JOBS; slot++ )); do
+                                                                pid=${slot_pid[$slot]}
+                                                                if [[ -z "$pid" ]] || ! kill -0 $pid 2> /dev/null; then
+                                                                        break 2
+                                                                fi
+                                                        done
+                                                        wait -n
+                                                done
+
+                                                idx=$(( idx + 1 ))
+                                                echo "$(date "+%Y-%m-%d %H:%M:%S") Started test $idx (pkt_size = $pktsize num_pkts = $numpkts snd_delay = $send_delay rcv_delay = $process_delay rng_size = $ringsize) on cpus $(slot_cpus $slot)"
+                                                run_test $idx $rep $slot $pktsize $numpkts $ringsize $send_delay $process_delay &
+                                                slot_pid[$slot]=$!
+                                        done
+                                done
+                        done
+                done
+        done
+done
+
+wait
+
+RUNS="$OUTDIR/runs.csv"
+
+echo "run,rep,proto,pkt_size,num_pkts,ring_size,send_delay,process_delay,sent,received,dropped,expired,abandoned,processed,elapsed_sec,cpus,port,status" > "$RUNS"
+
+for (( i = 1; i <= idx; i++ )); do
+        cat "$OUTDIR/run.$i/result" >> "$RUNS"
+done
+
+# per grid point: mean and 95% CI half width (Student's t, n - 1 degrees of freedom) over repetitions
+awk -F, -v csv="$OUTDIR/sweep.csv" -v json="$OUTDIR/sweep.json" '
+function t975(df) {
+        split("12.706 4.303 3.182 2.776 2.571 2.447 2.365 2.306 2.262 2.228 " \
+              "2.201 2.179 2.160 2.145 2.131 2.120 2.110 2.101 2.093 2.086 " \
+              "2.080 2.074 2.069 2.064 2.060 2.056 2.052 2.048 2.045 2.042", t, " ")
+        return (df <= 30 ? t[df] : 1.960)
+}
+function mean(k, m,    s, i) {
+        s = 0
+        for (i = 1; i <= cnt[k]; i++)
+                s += val[k, m, i]
+        return s / cnt[k]
+}
+function ci(k, m,    mu, s, i) {
+        if (cnt[k] < 2)
+                return ""
+        mu = mean(k, m)
+        s = 0
+        for (i = 1; i <= cnt[k]; i++)
+                s += (val[k, m, i] - mu) ^ 2
+        return t975(cnt[k] - 1) * sqrt(s / (cnt[k] - 1)) / sqrt(cnt[k])
+}
+NR == 1 { next }
+{
+        key = $3 "," $4 "," $5 "," $6 "," $7 "," $8
+        if (!(key in cnt)) {
+                order[++nkeys] = key
+                cnt[key] = 0
+                failed[key] = 0
+        }
+        if ($18 != "ok" || $10 == "") {
+                failed[key]++
+                next
+        }
+        n = ++cnt[key]
+        sent = ($9 > 0 ? $9 : $10)
+        val[key, "loss", n] = (sent > 0 ? 1 - $14 / sent : 0)
+        val[key, "dropped", n] = $11
+        val[key, "expired", n] = $12
+        val[key, "abandoned", n] = $13
+        val[key, "processed", n] = $14
+        val[key, "elapsed", n] = $15
+}
+END {
+        nm = split("loss dropped expired abandoned processed elapsed", metric, " ")
+
+        printf "proto,pkt_size,num_pkts,ring_size,send_delay,process_delay,runs,failed" > csv
+        for (j = 1; j <= nm; j++)
+                printf ",%s_mean,%s_ci95", metric[j], metric[j] > csv
+        printf "\n" > csv
+
+        printf "[" > json
+
+        for (i = 1; i <= nkeys; i++) {
+                k = order[i]
+                split(k, f, ",")
+
+                printf "%s,%d,%d", k, cnt[k], failed[k] > csv
+                printf "%s\n  {\"proto\": \"%s\", \"pkt_size\": %s, \"num_pkts\": %s, " \
+                       "\"ring_size\": %s, \"send_delay\": %s, \"process_delay\": %s, " \
+                       "\"runs\": %d, \"failed\": %d", (i > 1 ? "," : ""), f[1], f[2], f[3],
+                       f[4], f[5], f[6], cnt[k], failed[k] > json
+
+                for (j = 1; j <= nm; j++) {
+                        m = metric[j]
+                        if (cnt[k] == 0) {
+                                printf ",," > csv
+                                printf ", \"%s_mean\": null, \"%s_ci95\": null", m, m > json
+                                continue
+                        }
+                        c = ci(k, m)
+                        printf ",%.6g,%s", mean(k, m), (c == "" ? "" : sprintf("%.6g", c)) > csv
+                        printf ", \"%s_mean\": %.6g, \"%s_ci95\": %s", m, mean(k, m), m,
+                               (c == "" ? "null" : sprintf("%.6g", c)) > json
+                }
+
+                printf "\n" > csv
+                printf "}" > json
+        }
+
+        printf "\n]\n" > json
+}' "$RUNS"
+
+SWEEP_END=$(date +%s)
+
+echo "$(date "+%Y-%m-%d %H:%M:%S") Finished $idx tests in $(( (SWEEP_END - SWEEP_START) / 60 ))m $(( (SWEEP_END - SWEEP_START) % 60 ))s"
+echo "Runs: $RUNS"
+echo "Summary: $OUTDIR/sweep.csv $OUTDIR/sweep.json"
+
+if grep -q ",checksum_fail$" "$RUNS"; then
+        echo "!!! Checksum fail (check run.N/rcv_out.log of runs marked checksum_fail)"
+        exit 1
+fi
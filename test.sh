@@ -222,7 +222,8 @@ function run_test()
 
         TS=`date "+%Y-%m-%d %H:%M:%S"`
         echo "$TS $params " >> $LOG_OUT
-        grep STATS $BASEPATH/rcv_err.log | awk '{print $3 " " $4 " " $3/($3+$4)}' >> $LOG_OUT
+        # expired and abandoned packets are lost as well as dropped ones
+        grep STATS $BASEPATH/rcv_err.log | awk '{lost = $3 + $5 + $6; print lost " " $4 " " lost/(lost+$4)}' >> $LOG_OUT
 #        echo >> $LOG_OUT
 
         #echo "$TS $params $out" >> $LOG_OUT
@@ -0,0 +1,274 @@
+/*
+ * tpacket.h - AF_PACKET TPACKET_V3 memory mapped receive ring.
+ *
+ * Kernel fills blocks of frames in the shared ring, userspace walks a block
+ * once it is retired (either full or after `retire_tov' msecs) and hands it
+ * back. A classic BPF filter keeps everything but our UDP port out of the
+ * ring, so no syscall is made per packet (only poll(2) when ring is empty).
+ */
+
+#ifndef _TPACKET_H_
+#define _TPACKET_H_
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#define TPACKET_BLOCK_SIZE (1 << 20)    /* Ring block size (multiple of page size) */
+#define TPACKET_BLOCK_NR 16             /* Number of blocks in ring */
+#define TPACKET_FRAME_SIZE 2048
+#define TPACKET_RETIRE_TOV 10           /* Block retire timeout (in msecs) */
+
+/* called for every UDP datagram to our port, `data' points into the ring */
+typedef void (*tpacket_datagram_fn)(void *arg, uint8_t *data, size_t len);
+
+struct tpacket_ring {
+        int fd;
+        uint8_t *map;
+        size_t map_len;
+
+        uint32_t block_size;
+        uint32_t block_nr;
+        uint32_t cur_block;
+
+        uint16_t port;
+        int verbose;
+        int wake_fd;                    /* readable fd cutting poll short, -1: none */
+
+        unsigned long blocks;           /* blocks walked */
+        unsigned long blocks_tmo;       /* ... of them retired by timeout */
+        unsigned long frames;           /* frames seen */
+        unsigned long datagrams;        /* ... of them delivered */
+        unsigned long polls;
+};
+
+/* ip and udp dst port `port' and not fragmented (as of tcpdump -dd) */
+static inline int
+tpacket_attach_filter(int fd, uint16_t port)
+{
+        struct sock_filter code[] = {
+                { 0x28, 0, 0, 0x0000000c },     /* ldh [12] */
+                { 0x15, 0, 8, 0x00000800 },     /* jeq #0x800 */
+                { 0x30, 0, 0, 0x00000017 },     /* ldb [23] */
+                { 0x15, 0, 6, 0x00000011 },     /* jeq #17 */
+                { 0x28, 0, 0, 0x00000014 },     /* ldh [20] */
+                { 0x45, 4, 0, 0x00001fff },     /* jset #0x1fff */
+                { 0xb1, 0, 0, 0x0000000e },     /* ldxb 4*([14]&0xf) */
+                { 0x48, 0, 0, 0x00000010 },     /* ldh [x + 16] */
+                { 0x15, 0, 1, port },           /* jeq #port */
+                { 0x06, 0, 0, 0x00040000 },     /* ret #262144 */
+                { 0x06, 0, 0, 0x00000000 },     /* ret #0 */
+        };
+        struct sock_fprog prog = { sizeof(code) / sizeof(code[0]), code };
+
+        return setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+}
+
+/* returns 0 on success */
+static inline int
+tpacket_ring_open(struct tpacket_ring *r, const char *ifname, uint16_t port,
+                  uint32_t block_size, uint32_t block_nr, uint32_t retire_tov)
+{
+        struct tpacket_req3 req;
+        struct sockaddr_ll ll;
+        int v = TPACKET_V3;
+
+        memset(r, 0, sizeof(*r));
+        r->wake_fd = -1;
+        r->port = port;
+        r->block_size = block_size;
+        r->block_nr = block_nr;
+
+        if ((r->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_IP))) < 0) {
+                fprintf(stderr, "socket(AF_PACKET) failed: %s\n", strerror(errno));
+                return -1;
+        }
+
+        if (tpacket_attach_filter(r->fd, port) < 0)
+                fprintf(stderr, "SO_ATTACH_FILTER failed: %s\n", strerror(errno));
+
+        if (setsockopt(r->fd, SOL_PACKET, PACKET_VERSION, &v, sizeof(v)) < 0) {
+                fprintf(stderr, "PACKET_VERSION failed: %s\n", strerror(errno));
+                goto fail;
+        }
+
+        memset(&req, 0, sizeof(req));
+        req.tp_block_size = block_size;
+        req.tp_block_nr = block_nr;
+        req.tp_frame_size = TPACKET_FRAME_SIZE;
+        req.tp_frame_nr = (block_size * block_nr) / TPACKET_FRAME_SIZE;
+        req.tp_retire_blk_tov = retire_tov;
+
+        if (setsockopt(r->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+                fprintf(stderr, "PACKET_RX_RING failed: %s\n", strerror(errno));
+                goto fail;
+        }
+
+        r->map_len = (size_t)block_size * block_nr;
+        r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED,
+                      r->fd, 0);
+
+        if (r->map == MAP_FAILED) {
+                /* MAP_LOCKED may hit RLIMIT_MEMLOCK */
+                r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0);
+
+                if (r->map == MAP_FAILED) {
+                        fprintf(stderr, "mmap() failed: %s\n", strerror(errno));
+                        goto fail;
+                }
+        }
+
+        memset(&ll, 0, sizeof(ll));
+        ll.sll_family = AF_PACKET;
+        ll.sll_protocol = htons(ETH_P_IP);
+        ll.sll_ifindex = if_nametoindex(ifname);
+
+        if (ll.sll_ifindex == 0) {
+                fprintf(stderr, "Unknown interface '%s'\n", ifname);
+                goto fail_unmap;
+        }
+
+        if (bind(r->fd, (struct sockaddr *)&ll, sizeof(ll)) < 0) {
+                fprintf(stderr, "bind(AF_PACKET) failed: %s\n", strerror(errno));
+                goto fail_unmap;
+        }
+
+        return 0;
+
+ fail_unmap:
+        munmap(r->map, r->map_len);
+ fail:
+        close(r->fd);
+        return -1;
+}
+
+static inline void
+tpacket_ring_close(struct tpacket_ring *r)
+{
+        munmap(r->map, r->map_len);
+        close(r->fd);
+}
+
+static inline void
+tpacket_frame(struct tpacket_ring *r, struct tpacket3_hdr *h, tpacket_datagram_fn deliver,
+              void *arg)
+{
+        struct sockaddr_ll *ll = (struct sockaddr_ll *)((uint8_t *)h +
+                                                        TPACKET_ALIGN(sizeof(*h)));
+        uint8_t *net = (uint8_t *)h + h->tp_net;
+        uint32_t caplen = h->tp_snaplen - (h->tp_net - h->tp_mac);
+        struct iphdr *ip = (struct iphdr *)net;
+        struct udphdr *udp;
+        uint32_t ihl, len;
+
+        r->frames++;
+
+        /* loopback shows every packet twice */
+        if (ll->sll_pkttype == PACKET_OUTGOING)
+                return;
+
+        if (caplen < sizeof(*ip) || ip->version != 4 || ip->protocol != IPPROTO_UDP ||
+            (ntohs(ip->frag_off) & 0x3fff) != 0)
+                return;
+
+        ihl = ip->ihl * 4;
+
+        if (caplen < ihl + sizeof(*udp))
+                return;
+
+        udp = (struct udphdr *)(net + ihl);
+
+        if (ntohs(udp->dest) != r->port)
+                return;
+
+        len = ntohs(udp->len);
+
+        if (len < sizeof(*udp) || ihl + len > caplen)
+                return;
+
+        r->datagrams++;
+        deliver(arg, (uint8_t *)udp + sizeof(*udp), len - sizeof(*udp));
+}
+
+/*
+ * walk next retired block (waits up to `timeout' msecs for it or until
+ * wake_fd is readable, doesn't wait at all if 0), returns number of frames
+ * in block or 0 on timeout
+ */
+static inline int
+tpacket_ring_poll(struct tpacket_ring *r, int timeout, tpacket_datagram_fn deliver, void *arg)
+{
+        struct tpacket_block_desc *bd;
+        struct tpacket3_hdr *h;
+        struct pollfd pfd[2] = { { r->fd, POLLIN | POLLERR, 0 }, { r->wake_fd, POLLIN, 0 } };
+        uint32_t i, n;
+
+        bd = (struct tpacket_block_desc *)(r->map + (size_t)r->cur_block * r->block_size);
+
+        if (!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+                /* busy polling caller just checks the ring */
+                if (timeout == 0)
+                        return 0;
+
+                r->polls++;
+                poll(pfd, 2, timeout);
+
+                if (!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) &
+                      TP_STATUS_USER))
+                        return 0;
+        }
+
+        n = bd->hdr.bh1.num_pkts;
+        h = (struct tpacket3_hdr *)((uint8_t *)bd + bd->hdr.bh1.offset_to_first_pkt);
+
+        for (i = 0; i < n; i++) {
+                tpacket_frame(r, h, deliver, arg);
+                h = (struct tpacket3_hdr *)((uint8_t *)h + h->tp_next_offset);
+        }
+
+        r->blocks++;
+
+        if (bd->hdr.bh1.block_status & TP_STATUS_BLK_TMO)
+                r->blocks_tmo++;
+
+        if (r->verbose)
+                fprintf(stderr, "TPACKET block %u seq %llu: %u frames, %u bytes%s\n",
+                        r->cur_block, (unsigned long long)bd->hdr.bh1.seq_num, n,
+                        bd->hdr.bh1.blk_len,
+                        (bd->hdr.bh1.block_status & TP_STATUS_BLK_TMO) ? " (timeout)" : "");
+
+        __atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        r->cur_block = (r->cur_block + 1) % r->block_nr;
+
+        return n;
+}
+
+static inline void
+tpacket_ring_print_stats(struct tpacket_ring *r)
+{
+        struct tpacket_stats_v3 st;
+        socklen_t len = sizeof(st);
+
+        memset(&st, 0, sizeof(st));
+        getsockopt(r->fd, SOL_PACKET, PACKET_STATISTICS, &st, &len);
+
+        fprintf(stdout, "TPACKET blocks=%lu timeout_blocks=%lu frames=%lu datagrams=%lu polls=%lu "
+                "kernel_packets=%u kernel_drops=%u freeze_q=%u\n",
+                r->blocks, r->blocks_tmo, r->frames, r->datagrams, r->polls,
+                st.tp_packets, st.tp_drops, st.tp_freeze_q_cnt);
+}
+
+#endif
@@ -0,0 +1,163 @@
+/*
+ * trace.h - sampled per-packet lifecycle tracing written as Chrome trace
+ * event JSON (chrome://tracing, ui.perfetto.dev).
+ *
+ * Only packets with seqid divisible by buffer's `every' are traced, so
+ * sender and receiver pick the same ones. Every thread appends to its own
+ * preallocated buffer (no locking, events past its capacity are counted as lost) and
+ * buffers are written out at exit. Packet events are async slices keyed by
+ * global id (seqid), so traces of both sides merged into one file put every
+ * packet on one track; counter events make their own tracks.
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TRACE_EVENTS_DEFAULT (256 * 1024)      /* per thread */
+
+struct trace_event {
+        uint64_t ts_ns;         /* CLOCK_MONOTONIC */
+        const char *name;       /* static string */
+        uint64_t value;         /* seqid or counter value */
+        char ph;                /* b, e, n (async) or C (counter) */
+};
+
+struct trace_buf {
+        const char *thread;
+        unsigned int every;     /* 0: tracing is off */
+        struct trace_event *ev;
+        uint32_t n;
+        uint32_t cap;
+        uint32_t lost;
+};
+
+static inline int
+trace_sampled(struct trace_buf *t, uint32_t seqid)
+{
+        return t->every && seqid % t->every == 0;
+}
+
+static inline void
+trace_buf_init(struct trace_buf *t, const char *thread, uint32_t cap, unsigned int every)
+{
+        t->thread = thread;
+        t->every = every;
+        t->n = 0;
+        t->lost = 0;
+        t->cap = cap;
+
+        if ((t->ev = calloc(cap, sizeof(struct trace_event))) == NULL) {
+                fprintf(stderr, "calloc()\n");
+                exit(EXIT_FAILURE);
+        }
+}
+
+static inline void
+trace_buf_free(struct trace_buf *t)
+{
+        free(t->ev);
+        t->ev = NULL;
+        t->every = 0;
+}
+
+static inline void
+trace_add(struct trace_buf *t, char ph, const char *name, uint64_t value, uint64_t ts_ns)
+{
+        struct trace_event *e;
+
+        if (t->ev == NULL)
+                return;
+
+        if (t->n == t->cap) {
+                t->lost++;
+                return;
+        }
+
+        e = &t->ev[t->n++];
+        e->ts_ns = ts_ns;
+        e->name = name;
+        e->value = value;
+        e->ph = ph;
+}
+
+/* packet `seqid' event (b: slice begin, e: slice end, n: instant) */
+static inline void
+trace_pkt(struct trace_buf *t, char ph, const char *name, uint32_t seqid, uint64_t ts_ns)
+{
+        trace_add(t, ph, name, seqid, ts_ns);
+}
+
+static inline void
+trace_counter(struct trace_buf *t, const char *name, uint64_t value, uint64_t ts_ns)
+{
+        trace_add(t, 'C', name, value, ts_ns);
+}
+
+/* write all buffers as one process `process' into `path', returns 0 on success */
+static inline int
+trace_write(const char *path, const char *process, struct trace_buf **bufs, unsigned int nbufs)
+{
+        unsigned long events = 0, lost = 0;
+        unsigned int every = 0;
+        struct trace_event *e;
+        unsigned int i, j;
+        int pid = getpid();
+        FILE *f;
+
+        if ((f = fopen(path, "w")) == NULL) {
+                fprintf(stderr, "fopen('%s') failed: %s\n", path, strerror(errno));
+                return -1;
+        }
+
+        fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+        fprintf(f, "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"tid\":0,"
+                "\"args\":{\"name\":\"%s\"}}", pid, process);
+
+        for (i = 0; i < nbufs; i++) {
+                if (bufs[i]->ev == NULL)
+                        continue;
+
+                fprintf(f, ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%u,"
+                        "\"args\":{\"name\":\"%s\"}}", pid, i + 1, bufs[i]->thread);
+
+                for (j = 0; j < bufs[i]->n; j++) {
+                        e = &bufs[i]->ev[j];
+
+                        if (e->ph == 'C')
+                                fprintf(f, ",\n{\"ph\":\"C\",\"name\":\"%s\",\"pid\":%d,\"tid\":%u,"
+                                        "\"ts\":%.3f,\"args\":{\"value\":%lu}}", e->name,
+                                        pid, i + 1, e->ts_ns / 1e3, (unsigned long)e->value);
+                        else
+                                fprintf(f, ",\n{\"ph\":\"%c\",\"cat\":\"pkt\",\"name\":\"%s\","
+                                        "\"id2\":{\"global\":\"%lu\"},\"pid\":%d,\"tid\":%u,"
+                                        "\"ts\":%.3f,\"args\":{\"seqid\":%lu}}", e->ph,
+                                        e->name, (unsigned long)e->value, pid, i + 1,
+                                        e->ts_ns / 1e3, (unsigned long)e->value);
+                }
+
+                every = bufs[i]->every;
+                events += bufs[i]->n;
+                lost += bufs[i]->lost;
+        }
+
+        fprintf(f, "\n]}\n");
+
+        if (fclose(f) != 0) {
+                fprintf(stderr, "fclose('%s') failed: %s\n", path, strerror(errno));
+                return -1;
+        }
+
+        fprintf(stdout, "TRACE events=%lu lost=%lu every=%u %s\n", events, lost, every,
+                path);
+
+        return 0;
+}
+
+#endif
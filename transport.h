@@ -0,0 +1,39 @@
+#ifndef _PKT_TRANSPORT_H_
+#define _PKT_TRANSPORT_H_
+
+#include <string.h>
+
+enum pkt_transport {
+        PKT_TRANSPORT_TCP = 0,
+        PKT_TRANSPORT_UDP,
+        PKT_TRANSPORT_SHM,    /* shm:NAME */
+        PKT_TRANSPORT_PACKET, /* packet:IFACE, UDP captured with AF_PACKET (receiver only) */
+};
+
+/*
+ * parse transport specification ("tcp", "udp", "shm:NAME", "packet:IFACE"),
+ * `arg' is set to the part after the colon (if any). Returns 0 on success.
+ */
+static inline int
+transport_parse(const char *spec, enum pkt_transport *t, const char **arg)
+{
+        *arg = NULL;
+
+        if (strcmp(spec, "tcp") == 0) {
+                *t = PKT_TRANSPORT_TCP;
+        } else if (strcmp(spec, "udp") == 0) {
+                *t = PKT_TRANSPORT_UDP;
+        } else if (strncmp(spec, "shm:", 4) == 0 && spec[4] != '\0') {
+                *t = PKT_TRANSPORT_SHM;
+                *arg = spec + 4;
+        } else if (strncmp(spec, "packet:", 7) == 0 && spec[7] != '\0') {
+                *t = PKT_TRANSPORT_PACKET;
+                *arg = spec + 7;
+        } else {
+                return -1;
+        }
+
+        return 0;
+}
+
+#endif
@@ -0,0 +1,344 @@
+/*
+ * uring.h - minimal io_uring(7) wrapper on top of raw syscalls (no liburing
+ * dependency): ring setup, SQE/CQE handling and provided buffer rings.
+ *
+ * Only what pkt_{sender,receiver} need is implemented, every
+ * io_uring_enter(2) call is counted in `enter_calls'.
+ */
+
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define URING_SQPOLL_IDLE 1000 /* SQ thread idle time before it sleeps (in msecs) */
+
+struct uring {
+        int fd;
+        unsigned flags;
+
+        unsigned *sq_head;
+        unsigned *sq_tail;
+        unsigned *sq_flags;
+        unsigned *sq_array;
+        unsigned sq_mask;
+        unsigned sq_entries;
+        unsigned sqe_tail;      /* local, published on uring_flush() */
+        struct io_uring_sqe *sqes;
+
+        unsigned *cq_head;
+        unsigned *cq_tail;
+        unsigned cq_mask;
+        struct io_uring_cqe *cqes;
+
+        void *sq_ptr;
+        void *cq_ptr;
+        size_t sq_len;
+        size_t cq_len;
+        size_t sqes_len;
+
+        unsigned long enter_calls;
+};
+
+struct uring_buf_ring {
+        struct io_uring_buf_ring *br;
+        uint8_t *bufs;
+        size_t len;
+        uint32_t buf_size;
+        uint16_t entries;
+        uint16_t mask;
+        uint16_t bgid;
+        uint16_t tail;
+};
+
+static inline int
+uring_enter(struct uring *r, unsigned to_submit, unsigned min_complete, unsigned flags,
+            void *arg, size_t argsz)
+{
+        r->enter_calls++;
+        return syscall(SYS_io_uring_enter, r->fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+/* returns 0 on success, -1 (errno is set) if io_uring is not available */
+static inline int
+uring_init(struct uring *r, unsigned entries, int sqpoll)
+{
+        struct io_uring_params p;
+        uint8_t *sq, *cq;
+
+        memset(r, 0, sizeof(*r));
+        memset(&p, 0, sizeof(p));
+
+        if (sqpoll) {
+                p.flags |= IORING_SETUP_SQPOLL;
+                p.sq_thread_idle = URING_SQPOLL_IDLE;
+        }
+
+        r->fd = syscall(SYS_io_uring_setup, entries, &p);
+
+        if (r->fd < 0)
+                return -1;
+
+        r->flags = p.flags;
+
+        r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+        if (p.features & IORING_FEAT_SINGLE_MMAP) {
+                if (r->cq_len > r->sq_len)
+                        r->sq_len = r->cq_len;
+                r->cq_len = r->sq_len;
+        }
+
+        r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         r->fd, IORING_OFF_SQ_RING);
+
+        if (r->sq_ptr == MAP_FAILED)
+                goto fail;
+
+        if (p.features & IORING_FEAT_SINGLE_MMAP) {
+                r->cq_ptr = r->sq_ptr;
+        } else {
+                r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+
+                if (r->cq_ptr == MAP_FAILED)
+                        goto fail_sq;
+        }
+
+        r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+        r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       r->fd, IORING_OFF_SQES);
+
+        if (r->sqes == MAP_FAILED)
+                goto fail_cq;
+
+        sq = r->sq_ptr;
+        cq = r->cq_ptr;
+
+        r->sq_head = (unsigned *)(sq + p.sq_off.head);
+        r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+        r->sq_flags = (unsigned *)(sq + p.sq_off.flags);
+        r->sq_array = (unsigned *)(sq + p.sq_off.array);
+        r->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+        r->sq_entries = *(unsigned *)(sq + p.sq_off.ring_entries);
+        r->sqe_tail = *r->sq_tail;
+
+        r->cq_head = (unsigned *)(cq + p.cq_off.head);
+        r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+        r->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+        r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+        return 0;
+
+ fail_cq:
+        /* reverse order of mapping, as uring_exit() */
+        if (r->cq_ptr != r->sq_ptr)
+                munmap(r->cq_ptr, r->cq_len);
+ fail_sq:
+        munmap(r->sq_ptr, r->sq_len);
+ fail:
+        close(r->fd);
+        return -1;
+}
+
+static inline void
+uring_exit(struct uring *r)
+{
+        munmap(r->sqes, r->sqes_len);
+
+        if (r->cq_ptr != r->sq_ptr)
+                munmap(r->cq_ptr, r->cq_len);
+
+        munmap(r->sq_ptr, r->sq_len);
+        close(r->fd);
+}
+
+/* returns zeroed SQE or NULL if submission queue is full */
+static inline struct io_uring_sqe *
+uring_get_sqe(struct uring *r)
+{
+        struct io_uring_sqe *sqe;
+        unsigned idx;
+
+        if (r->sqe_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->sq_entries)
+                return NULL;
+
+        idx = r->sqe_tail & r->sq_mask;
+        sqe = &r->sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        r->sq_array[idx] = idx;
+        r->sqe_tail++;
+
+        return sqe;
+}
+
+/* publish queued SQEs to the kernel, returns number of new entries */
+static inline unsigned
+uring_flush(struct uring *r)
+{
+        unsigned n = r->sqe_tail - *r->sq_tail;
+
+        __atomic_store_n(r->sq_tail, r->sqe_tail, __ATOMIC_RELEASE);
+
+        return n;
+}
+
+static inline unsigned
+uring_cq_ready(struct uring *r)
+{
+        return __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE) - *r->cq_head;
+}
+
+/*
+ * submit pending SQEs and wait for `wait_nr' completions. With SQPOLL no
+ * syscall is made unless SQ thread went to sleep, completions are spun on.
+ */
+static inline int
+uring_submit_and_wait(struct uring *r, unsigned wait_nr)
+{
+        unsigned n = uring_flush(r);
+        int ret;
+
+        if (r->flags & IORING_SETUP_SQPOLL) {
+                __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+                if (__atomic_load_n(r->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP)
+                        uring_enter(r, 0, 0, IORING_ENTER_SQ_WAKEUP, NULL, 0);
+
+                while (uring_cq_ready(r) < wait_nr)
+                        ;
+
+                return 0;
+        }
+
+        if (n == 0 && (wait_nr == 0 || uring_cq_ready(r) >= wait_nr))
+                return 0;
+
+        do {
+                ret = uring_enter(r, n, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        } while (ret < 0 && errno == EINTR);
+
+        return ret < 0 ? -1 : 0;
+}
+
+static inline struct io_uring_cqe *
+uring_peek_cqe(struct uring *r)
+{
+        if (uring_cq_ready(r) == 0)
+                return NULL;
+
+        return &r->cqes[*r->cq_head & r->cq_mask];
+}
+
+/* submit pending SQEs and wait for a completion up to `msec' */
+static inline struct io_uring_cqe *
+uring_wait_cqe_timeout(struct uring *r, long msec)
+{
+        struct __kernel_timespec ts = { msec / 1000, (msec % 1000) * 1000000L };
+        struct io_uring_getevents_arg arg;
+        struct io_uring_cqe *cqe;
+        unsigned n = uring_flush(r);
+        unsigned flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+
+        if ((cqe = uring_peek_cqe(r)) != NULL && n == 0)
+                return cqe;
+
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+
+        if ((r->flags & IORING_SETUP_SQPOLL) &&
+            (__atomic_load_n(r->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP))
+                flags |= IORING_ENTER_SQ_WAKEUP;
+
+        if (uring_enter(r, (r->flags & IORING_SETUP_SQPOLL) ? 0 : n, 1, flags,
+                        &arg, sizeof(arg)) < 0 && errno != ETIME && errno != EINTR)
+                return NULL;
+
+        return uring_peek_cqe(r);
+}
+
+static inline void
+uring_cqe_seen(struct uring *r)
+{
+        __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+static inline void
+uring_buf_ring_add(struct uring_buf_ring *b, uint16_t bid)
+{
+        struct io_uring_buf *buf = &b->br->bufs[b->tail & b->mask];
+
+        buf->addr = (uint64_t)(uintptr_t)(b->bufs + (size_t)bid * b->buf_size);
+        buf->len = b->buf_size;
+        buf->bid = bid;
+
+        b->tail++;
+        __atomic_store_n(&b->br->tail, b->tail, __ATOMIC_RELEASE);
+}
+
+static inline uint8_t *
+uring_buf_ring_buf(struct uring_buf_ring *b, uint16_t bid)
+{
+        return b->bufs + (size_t)bid * b->buf_size;
+}
+
+/*
+ * register provided buffer ring `bgid' of `entries' (power of 2) buffers of
+ * `buf_size' bytes each, all buffers are handed to the kernel
+ */
+static inline int
+uring_buf_ring_setup(struct uring *r, struct uring_buf_ring *b, uint16_t bgid,
+                     uint16_t entries, uint32_t buf_size)
+{
+        struct io_uring_buf_reg reg;
+        size_t ring_len = entries * sizeof(struct io_uring_buf);
+        uint16_t i;
+
+        memset(b, 0, sizeof(*b));
+
+        b->len = ring_len + (size_t)entries * buf_size;
+        b->br = mmap(NULL, b->len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (b->br == MAP_FAILED)
+                return -1;
+
+        b->bufs = (uint8_t *)b->br + ring_len;
+        b->buf_size = buf_size;
+        b->entries = entries;
+        b->mask = entries - 1;
+        b->bgid = bgid;
+
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = (uint64_t)(uintptr_t)b->br;
+        reg.ring_entries = entries;
+        reg.bgid = bgid;
+
+        if (syscall(SYS_io_uring_register, r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+                munmap(b->br, b->len);
+                return -1;
+        }
+
+        for (i = 0; i < entries; i++)
+                uring_buf_ring_add(b, i);
+
+        return 0;
+}
+
+static inline void
+uring_buf_ring_free(struct uring_buf_ring *b)
+{
+        munmap(b->br, b->len);
+}
+
+#endif
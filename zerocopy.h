@@ -0,0 +1,186 @@
+/*
+ * zerocopy.h - MSG_ZEROCOPY sends and completion tracking.
+ *
+ * Every successful send() with MSG_ZEROCOPY takes next notification id (per
+ * socket, starting at 0). Kernel reports ranges of ids whose pages it no
+ * longer references on socket error queue, so a buffer may be reused only
+ * when all ids it was sent with are completed. Id -> owner window maps
+ * completions back to caller's buffers.
+ */
+
+#ifndef _ZEROCOPY_H_
+#define _ZEROCOPY_H_
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+#define ZC_WINDOW 4096          /* max ids in flight (power of 2) */
+#define ZC_WAIT_MSEC 100
+
+/* called once for every completed id, with its owner */
+typedef void (*zc_complete_fn)(int32_t owner);
+
+struct zc_tracker {
+        int fd;
+        uint32_t next_id;
+        int32_t owner[ZC_WINDOW];       /* -1: completed */
+
+        unsigned long syscalls;         /* send(), recvmsg() and poll() calls */
+        unsigned long sends;
+        unsigned long completions;
+        unsigned long copied;           /* ... of them kernel fell back to copy */
+        unsigned long notifications;
+};
+
+/* returns 0 on success */
+static inline int
+zc_init(struct zc_tracker *z, int fd)
+{
+        int one = 1;
+        unsigned int i;
+
+        memset(z, 0, sizeof(*z));
+        z->fd = fd;
+
+        for (i = 0; i < ZC_WINDOW; i++)
+                z->owner[i] = -1;
+
+        return setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one));
+}
+
+/*
+ * read all pending notifications, waits up to `timeout' msecs if there are
+ * none yet; returns number of notifications read
+ */
+static inline int
+zc_reap(struct zc_tracker *z, int timeout, zc_complete_fn done)
+{
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err)) +
+                     CMSG_SPACE(sizeof(struct sockaddr_in))];
+        struct pollfd pfd = { z->fd, 0, 0 };    /* POLLERR is always reported */
+        struct sock_extended_err *serr;
+        struct cmsghdr *cm;
+        struct msghdr msg;
+        uint32_t id, lo, hi;
+        int n = 0;
+
+        for (;;) {
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_control = control;
+                msg.msg_controllen = sizeof(control);
+
+                z->syscalls++;
+
+                if (recvmsg(z->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        if (errno == EAGAIN && n == 0 && timeout != 0) {
+                                z->syscalls++;
+                                poll(&pfd, 1, timeout);
+                                timeout = 0;
+                                continue;
+                        }
+
+                        break;
+                }
+
+                for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+                        if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR))
+                                continue;
+
+                        serr = (struct sock_extended_err *)CMSG_DATA(cm);
+
+                        if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0)
+                                continue;
+
+                        lo = serr->ee_info;
+                        hi = serr->ee_data;
+
+                        z->notifications++;
+
+                        if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                                z->copied += hi - lo + 1;
+
+                        for (id = lo; id != hi + 1; id++) {
+                                int32_t *o = &z->owner[id % ZC_WINDOW];
+
+                                if (*o >= 0) {
+                                        done(*o);
+                                        *o = -1;
+                                }
+
+                                z->completions++;
+                        }
+
+                        n++;
+                }
+        }
+
+        return n;
+}
+
+/*
+ * send whole buffer with MSG_ZEROCOPY (more than one send() on short writes),
+ * all ids taken are owned by `owner'. Returns number of ids taken or -1.
+ */
+static inline int
+zc_send(struct zc_tracker *z, const uint8_t *buf, size_t len, int32_t owner,
+        zc_complete_fn done)
+{
+        size_t off = 0;
+        ssize_t ret;
+        int ids = 0;
+
+        while (off < len) {
+                while (z->owner[z->next_id % ZC_WINDOW] >= 0)
+                        zc_reap(z, ZC_WAIT_MSEC, done);
+
+                z->syscalls++;
+
+                if ((ret = send(z->fd, buf + off, len - off, MSG_ZEROCOPY)) < 0) {
+                        if (errno == EINTR || errno == EAGAIN)
+                                continue;
+
+                        /* out of optmem for notifications: reap some first */
+                        if (errno == ENOBUFS) {
+                                zc_reap(z, ZC_WAIT_MSEC, done);
+                                continue;
+                        }
+
+                        return -1;
+                }
+
+                z->owner[z->next_id++ % ZC_WINDOW] = owner;
+                z->sends++;
+                ids++;
+                off += ret;
+        }
+
+        return ids;
+}
+
+static inline void
+zc_print_stats(FILE *f, struct zc_tracker *z)
+{
+        fprintf(f, "ZEROCOPY sends=%lu completions=%lu copied=%lu notifications=%lu\n",
+                z->sends, z->completions, z->copied, z->notifications);
+}
+
+#endif